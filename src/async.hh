@@ -1,17 +1,45 @@
 #pragma once
 
+#include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <condition_variable>
 #include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
 #include <exception>
 #include <functional>
 #include <map>
-#include <print>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <optional>
+#include <source_location>
 #include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <variant>
+#include <vector>
+#ifdef _COROUTINE_DEBUG
+#include <print>
+#endif
+
+// defined as 'export' when included by the cppasync module interface
+#ifndef CPPASYNC_EXPORT
+#define CPPASYNC_EXPORT
+#endif
+
+// the module provides these by the cppasync:debug partition
+#if defined(_COROUTINE_DEBUG) && !defined(CPPASYNC_MODULE)
+#include "async_debug.hh"
+#endif
 
-namespace cppasync {
+CPPASYNC_EXPORT namespace cppasync {
 
 template <typename T>
 class async;
+class async_scope;
 
 class broken_promise : public std::logic_error {
     public:
@@ -34,24 +62,178 @@ class unfinished_promise : public std::logic_error {
         explicit unfinished_promise(const char* what) : logic_error(what) {}
 };
 
-#ifdef _COROUTINE_DEBUG
-extern unsigned promise_sn_counter;
-extern unsigned async_sn_counter;
-extern unsigned awaitable_sn_counter;
-extern unsigned promise_use_counter;
-extern unsigned async_use_counter;
-extern unsigned awaitable_use_counter;
-extern std::coroutine_handle<> global_continuation;
-unsigned getSNforHandle(std::coroutine_handle<> handle);
-inline void resetCounters() {
-    promise_sn_counter = async_sn_counter = awaitable_sn_counter = promise_use_counter = async_use_counter = awaitable_use_counter = 0;
-}
+// bump allocator for coroutine frames, all of which are released at once by release() or
+// when the arena is destroyed. the arena must outlive the frames allocated from it.
+class frame_arena {
+    public:
+        explicit frame_arena(std::size_t chunk_size = 16384) noexcept : m_chunk_size(chunk_size) {}
+        frame_arena(const frame_arena&) = delete;
+        frame_arena& operator=(const frame_arena&) = delete;
+        ~frame_arena() { release(); }
+
+        void* allocate(std::size_t size) {
+            size = (size + alignment - 1) & ~(alignment - 1);
+            if (static_cast<std::size_t>(m_end - m_free) < size) {
+                grow(size);
+            }
+            auto ptr = m_free;
+            m_free += size;
+            m_allocated += size;
+            return ptr;
+        }
+        void release() noexcept {
+            while (m_chunks) {
+                auto chunk = m_chunks;
+                m_chunks = chunk->next;
+                ::operator delete(chunk);
+            }
+            m_free = m_end = nullptr;
+            m_allocated = 0;
+        }
+        // bytes handed out since the last release()
+        std::size_t allocated() const noexcept { return m_allocated; }
+
+    private:
+        static constexpr std::size_t alignment = __STDCPP_DEFAULT_NEW_ALIGNMENT__;
+        struct alignas(alignment) chunk {
+                chunk* next;
+        };
+        void grow(std::size_t size) {
+            auto capacity = std::max(size, m_chunk_size);
+            auto next = static_cast<chunk*>(::operator new(sizeof(chunk) + capacity));
+            next->next = m_chunks;
+            m_chunks = next;
+            m_free = reinterpret_cast<std::byte*>(next + 1);
+            m_end = m_free + capacity;
+        }
+
+        std::size_t m_chunk_size;
+        std::size_t m_allocated = 0;
+        chunk* m_chunks = nullptr;
+        std::byte* m_free = nullptr;
+        std::byte* m_end = nullptr;
+};
+
+namespace detail {
+
+class async_promise_base;
+
+// what the running coroutine passes on to the coroutines it calls: the arena for their frames
+// (unless called with an explicit std::allocator_arg) and their priority
+struct context {
+        frame_arena* arena = nullptr;
+        int priority = 0;
+#ifdef CPPASYNC_PROFILE
+        async_promise_base* frame = nullptr;  // the running coroutine
 #endif
+};
+inline thread_local context current_context;
+// hands the arena over from the promise's operator new to its constructor
+inline thread_local frame_arena* allocating_arena = nullptr;
+
+// each frame is prefixed with the arena it was allocated from or nullptr for the heap
+struct alignas(__STDCPP_DEFAULT_NEW_ALIGNMENT__) frame_prefix {
+        frame_arena* arena;
+};
+
+inline void* allocate_frame(std::size_t size, frame_arena* arena) {
+    auto prefix = static_cast<frame_prefix*>(arena ? arena->allocate(sizeof(frame_prefix) + size) : ::operator new(sizeof(frame_prefix) + size));
+    prefix->arena = arena;
+    allocating_arena = arena;
+    return prefix + 1;
+}
+
+inline void deallocate_frame(void* ptr) noexcept {
+    auto prefix = static_cast<frame_prefix*>(ptr) - 1;
+    if (!prefix->arena) {
+        ::operator delete(prefix);
+    }
+}
+
+}  // namespace detail
+
+// coroutines called within the lifetime of an arena_scope allocate their frames from the arena
+class arena_scope {
+    public:
+        explicit arena_scope(frame_arena* arena) noexcept : m_outer(std::exchange(detail::current_context.arena, arena)) {}
+        explicit arena_scope(frame_arena& arena) noexcept : arena_scope(&arena) {}
+        arena_scope(const arena_scope&) = delete;
+        arena_scope& operator=(const arena_scope&) = delete;
+        ~arena_scope() { detail::current_context.arena = m_outer; }
+
+    private:
+        frame_arena* m_outer;
+};
+
+// coroutines called within the lifetime of a priority_scope get the priority, the default is 0.
+// run_queue runs entries of a higher priority first.
+class priority_scope {
+    public:
+        explicit priority_scope(int priority) noexcept : m_outer(std::exchange(detail::current_context.priority, priority)) {}
+        priority_scope(const priority_scope&) = delete;
+        priority_scope& operator=(const priority_scope&) = delete;
+        ~priority_scope() { detail::current_context.priority = m_outer; }
+
+    private:
+        int m_outer;
+};
 
 namespace detail {
 
+// set while async_scope destroys its unfinished children, which then destroy their unfinished
+// asyncs without throwing unfinished_promise
+inline thread_local bool destroying_scope = false;
+
+template <typename AWAITABLE>
+decltype(auto) get_awaiter(AWAITABLE&& awaitable) {
+    if constexpr (requires { std::forward<AWAITABLE>(awaitable).operator co_await(); }) {
+        return std::forward<AWAITABLE>(awaitable).operator co_await();
+    } else if constexpr (requires { operator co_await(std::forward<AWAITABLE>(awaitable)); }) {
+        return operator co_await(std::forward<AWAITABLE>(awaitable));
+    } else {
+        return std::forward<AWAITABLE>(awaitable);
+    }
+}
+
+// restores the outer context while the coroutine is suspended
+template <typename AWAITER>
+struct context_awaiter {
+        AWAITER awaiter;
+        async_promise_base* promise;
+        bool left = false;
+        bool await_ready() { return awaiter.await_ready(); }
+        template <typename PROMISE>
+        decltype(auto) await_suspend(std::coroutine_handle<PROMISE> coro);
+        decltype(auto) await_resume();
+};
+
+std::coroutine_handle<> scope_finished(async_promise_base& promise, std::coroutine_handle<> coro) noexcept;
+
+// called from final_suspend() of the completing coroutine instead of resuming
+// its parent, returns the coroutine to continue with
+class completion {
+    public:
+        virtual std::coroutine_handle<> complete() noexcept = 0;
+
+    protected:
+        ~completion() = default;
+};
+
 class async_promise_base {
+        // set_completion() fails once m_completion is 'finished'
+        static inline completion* const finished = reinterpret_cast<completion*>(std::uintptr_t(1));
+
         std::coroutine_handle<> m_parent;
+        std::atomic<completion*> m_completion = nullptr;
+        // the coroutine might be finished by another thread than the one calling set_completion()
+        bool m_suspended = false;
+        // intrusive list of the coroutines spawned into an async_scope
+        async_scope* m_scope = nullptr;
+        async_promise_base* m_prev_child = nullptr;
+        async_promise_base* m_next_child = nullptr;
+        friend class cppasync::async_scope;
+        friend std::coroutine_handle<> scope_finished(async_promise_base& promise, std::coroutine_handle<> coro) noexcept;
+
         struct final_awaitable {
 #ifdef _COROUTINE_DEBUG
                 unsigned sn;
@@ -72,6 +254,21 @@ class async_promise_base {
 #endif
                 template <typename PROMISE>
                 std::coroutine_handle<> await_suspend(std::coroutine_handle<PROMISE> coro) noexcept {
+                    // an awaited coroutine has no completion
+                    if (!coro.promise().m_parent) {
+                        if (auto handler = coro.promise().finish()) {
+#ifdef _COROUTINE_DEBUG
+                            std::println("final_awaitable #{}: await_suspend() -> run completion for promise #{}", sn, getSNforHandle(coro));
+#endif
+                            return handler->complete();
+                        }
+                    }
+                    if (coro.promise().m_scope) {
+#ifdef _COROUTINE_DEBUG
+                        std::println("final_awaitable #{}: await_suspend() -> remove promise #{} from scope", sn, getSNforHandle(coro));
+#endif
+                        return scope_finished(coro.promise(), coro);
+                    }
                     auto continuation = coro.promise().m_parent;
                     if (!continuation) {
 #ifdef _COROUTINE_DEBUG
@@ -87,6 +284,9 @@ class async_promise_base {
                         return std::noop_coroutine();
                     }
                     coro.promise().m_parent = nullptr;
+#ifdef CPPASYNC_PROFILE
+                    coro.promise().m_awaiting.store(nullptr, std::memory_order_relaxed);
+#endif
 #ifdef _COROUTINE_DEBUG
                     std::println("awaitable #{}: await_suspend() -> continue with promise #{}", sn, getSNforHandle(continuation));
 #endif
@@ -99,9 +299,49 @@ class async_promise_base {
                 }
         };
 
+#ifdef CPPASYNC_PROFILE
+        context m_context{std::exchange(allocating_arena, nullptr), current_context.priority, this};
+        // the function of the coroutine and the coroutine awaiting it, see stack(). m_awaiting is atomic as it's
+        // read by the signal handler on any thread while e.g. an atomic_async is awaited and finished on others.
+        const char* m_function = "";
+        std::atomic<async_promise_base*> m_awaiting = nullptr;
+#else
+        context m_context{std::exchange(allocating_arena, nullptr), current_context.priority};
+#endif
+        context m_outer_context;
+        struct initial_awaitable {
+                async_promise_base* promise;
+                bool await_ready() const noexcept { return true; }
+                void await_suspend(std::coroutine_handle<>) const noexcept {}
+                void await_resume() const noexcept { promise->enter_context(); }
+        };
+
     public:
         bool drop = false;
         std::function<void(std::exception_ptr eptr)> fail;
+
+        // frames are allocated from the arena passed after a leading std::allocator_arg, otherwise from the current arena
+        static void* operator new(std::size_t size) { return allocate_frame(size, current_context.arena); }
+        template <typename... ARGS>
+        static void* operator new(std::size_t size, std::allocator_arg_t, frame_arena& arena, ARGS&...) {
+            return allocate_frame(size, &arena);
+        }
+        template <typename CLASS, typename... ARGS>
+        static void* operator new(std::size_t size, CLASS&, std::allocator_arg_t, frame_arena& arena, ARGS&...) {
+            return allocate_frame(size, &arena);
+        }
+        static void operator delete(void* ptr) noexcept { deallocate_frame(ptr); }
+
+        // while the coroutine is running, the coroutines it calls allocate their frames from the same arena
+        // and inherit its priority
+        template <typename AWAITABLE>
+        auto await_transform(AWAITABLE&& awaitable) {
+            return context_awaiter<decltype(get_awaiter(std::forward<AWAITABLE>(awaitable)))>{get_awaiter(std::forward<AWAITABLE>(awaitable)), this};
+        }
+        void enter_context() noexcept { m_outer_context = std::exchange(current_context, m_context); }
+        void leave_context() noexcept { current_context = m_outer_context; }
+        int priority() const noexcept { return m_context.priority; }
+
 #ifdef _COROUTINE_DEBUG
         unsigned sn;
         async_promise_base() noexcept {
@@ -119,9 +359,80 @@ class async_promise_base {
 
         // set the coroutine to proceed with after this coroutine is finished
         void set_parent(std::coroutine_handle<> parent) noexcept { m_parent = parent; }
+        template <typename PROMISE>
+        void set_parent(std::coroutine_handle<PROMISE> parent) noexcept {
+            m_parent = parent;
+            set_awaiting(parent);
+        }
+        // remember the coroutine awaiting this one for stack(), a handle<> clears it
+        template <typename PROMISE>
+        void set_awaiting([[maybe_unused]] std::coroutine_handle<PROMISE> awaiting) noexcept {
+#ifdef CPPASYNC_PROFILE
+            if constexpr (std::is_base_of_v<async_promise_base, PROMISE>) {
+                m_awaiting.store(&awaiting.promise(), std::memory_order_relaxed);
+            } else {
+                m_awaiting.store(nullptr, std::memory_order_relaxed);
+            }
+#endif
+        }
+        // get_return_object() is called with the location of the coroutine
+        void set_function([[maybe_unused]] const std::source_location& where) noexcept {
+#ifdef CPPASYNC_PROFILE
+            m_function = where.function_name();
+#endif
+        }
+#ifdef CPPASYNC_PROFILE
+        // store the functions of the running coroutine, of the coroutines it was called by and of those awaiting
+        // them, innermost first. only reads pointers, so it can be called from a signal handler.
+        static std::size_t stack(const char** functions, std::size_t max) noexcept {
+            std::size_t depth = 0;
+            bool running = true;
+            for (auto frame = current_context.frame; frame && depth < max;) {
+                functions[depth++] = frame->m_function;
+                if (auto awaiting = frame->m_awaiting.load(std::memory_order_relaxed)) {
+                    frame = awaiting;
+                    running = false;
+                } else if (running) {
+                    // called by the coroutine which was running when this one was resumed
+                    frame = frame->m_outer_context.frame;
+                } else {
+                    break;
+                }
+            }
+            return depth;
+        }
+#endif
+        // set the completion to run inline after this coroutine is finished, returns false when it has already
+        // finished and the completion won't be run
+        bool set_completion(completion* handler) noexcept {
+            auto expected = m_completion.load(std::memory_order_acquire);
+            while (expected != finished) {
+                if (m_completion.compare_exchange_weak(expected, handler, std::memory_order_acq_rel, std::memory_order_acquire)) {
+                    return true;
+                }
+            }
+            return false;
+        }
+        void mark_suspended() noexcept { m_suspended = true; }
+
+    private:
+        // called from final_suspend(), returns the completion set before. a coroutine which was never suspended
+        // is finished by the thread which called it, before anyone could have set a completion, and gets away
+        // without an atomic read-modify-write.
+        completion* finish() noexcept {
+            if (m_suspended) {
+                return m_completion.exchange(finished, std::memory_order_acq_rel);
+            }
+            auto handler = m_completion.load(std::memory_order_relaxed);
+            m_completion.store(finished, std::memory_order_relaxed);
+            return handler;
+        }
 
-        std::suspend_never initial_suspend() { return {}; }
+    public:
+
+        initial_awaitable initial_suspend() noexcept { return {this}; }
         final_awaitable final_suspend() noexcept {
+            leave_context();
 #ifdef _COROUTINE_DEBUG
             auto asn = ++awaitable_sn_counter;
             std::println("promise #{}: final_suspend() -> create and return final awaitable #{}", sn, asn);
@@ -131,17 +442,44 @@ class async_promise_base {
 #endif
         }
 };
+template <typename AWAITER>
+template <typename PROMISE>
+decltype(auto) context_awaiter<AWAITER>::await_suspend(std::coroutine_handle<PROMISE> coro) {
+    promise->leave_context();
+    promise->mark_suspended();
+    left = true;
+    try {
+        return awaiter.await_suspend(coro);
+    } catch (...) {
+        // the coroutine continues in its catch block without await_resume()
+        promise->enter_context();
+        left = false;
+        throw;
+    }
+}
+
+template <typename AWAITER>
+decltype(auto) context_awaiter<AWAITER>::await_resume() {
+    if (left) {
+        promise->enter_context();
+    }
+    return awaiter.await_resume();
+}
+
 }  // namespace detail
 
 #ifdef _COROUTINE_DEBUG
-inline unsigned getSNforHandle(std::coroutine_handle<> handle) { return ((std::coroutine_handle<detail::async_promise_base>*)&handle)->promise().sn; }
+// like its declaration in async_debug.hh attached to the global module
+extern "C++" inline unsigned getSNforHandle(std::coroutine_handle<> handle) {
+    return ((std::coroutine_handle<detail::async_promise_base>*)&handle)->promise().sn;
+}
 #endif
 
 namespace detail {
 
 // the VALUE specialisation of async_promise_base
 template <typename T>
-class async_promise final : public async_promise_base {
+class async_promise : public async_promise_base {
     public:
         async_promise() noexcept {}
         ~async_promise() {
@@ -162,7 +500,7 @@ class async_promise final : public async_promise_base {
                     break;
             }
         }
-        async<T> get_return_object() noexcept;
+        async<T> get_return_object(std::source_location where = std::source_location::current()) noexcept;
         void unhandled_exception() noexcept {
             ::new (static_cast<void*>(std::addressof(m_exception))) std::exception_ptr(std::current_exception());
             m_resultType = result_type::exception;
@@ -222,7 +560,7 @@ class async_promise<void> : public async_promise_base {
                 }
             }
         }
-        async<void> get_return_object() noexcept;
+        async<void> get_return_object(std::source_location where = std::source_location::current()) noexcept;
         void return_void() noexcept {
 #ifdef _COROUTINE_DEBUG
             std::println("promise #{}: return_void()", sn);
@@ -250,11 +588,14 @@ class async_promise<T&> : public async_promise_base {
     public:
         async_promise() noexcept = default;
         ~async_promise() {
+            if (m_exception && fail) {
+                fail(m_exception);
+            }
             // if (then != nullptr) {
             //     (*then)(m_value);
             // }
         }
-        async<T&> get_return_object() noexcept;
+        async<T&> get_return_object(std::source_location where = std::source_location::current()) noexcept;
         void unhandled_exception() noexcept { m_exception = std::current_exception(); }
         void return_value(T& value) noexcept { m_value = std::addressof(value); }
         T& result() {
@@ -269,10 +610,195 @@ class async_promise<T&> : public async_promise_base {
         T* m_value = nullptr;
         std::exception_ptr m_exception;
 };
+template <typename S, typename F>
+class map_adapter;
+template <typename S, typename F>
+class and_then_adapter;
+template <typename S, typename F>
+class or_else_adapter;
+
+// map(), and_then() and or_else() for async and the adapters returned by them
+template <typename SELF>
+class chainable {
+    public:
+        // co_await returns fn(result)
+        template <typename F>
+        map_adapter<SELF, std::decay_t<F>> map(F&& fn) && {
+            return {static_cast<SELF&&>(*this), std::forward<F>(fn)};
+        }
+        // co_await returns co_await fn(result)
+        template <typename F>
+        and_then_adapter<SELF, std::decay_t<F>> and_then(F&& fn) && {
+            return {static_cast<SELF&&>(*this), std::forward<F>(fn)};
+        }
+        // co_await returns the result or, in case of an exception, fn(exception_ptr)
+        template <typename F>
+        or_else_adapter<SELF, std::decay_t<F>> or_else(F&& fn) && {
+            return {static_cast<SELF&&>(*this), std::forward<F>(fn)};
+        }
+};
+
+// recycles the memory of the ready_results of SIZE bytes per thread, so that make_ready_async() doesn't call malloc
+// once the thread's free list is warm. at most 'max_free' blocks are kept.
+template <std::size_t SIZE>
+class ready_pool {
+    public:
+        static void* allocate() {
+            auto& list = free_list();
+            if (auto block = list.head) {
+                list.head = block->next;
+                --list.size;
+                return block;
+            }
+            return ::operator new(SIZE);
+        }
+        static void deallocate(void* memory) noexcept {
+            auto& list = free_list();
+            if (list.size >= max_free) {
+                ::operator delete(memory);
+                return;
+            }
+            list.head = new (memory) block{list.head};
+            ++list.size;
+        }
+
+    private:
+        static constexpr std::size_t max_free = 256;
+        struct block {
+                block* next;
+        };
+        static_assert(SIZE >= sizeof(block));
+        struct list {
+                block* head = nullptr;
+                std::size_t size = 0;
+                ~list() {
+                    while (head) {
+                        ::operator delete(std::exchange(head, head->next));
+                    }
+                    // ready_results released later on this thread are deleted right away
+                    size = max_free;
+                }
+        };
+        static list& free_list() noexcept {
+            static thread_local list l;
+            return l;
+        }
+};
+
+// the result of an async made by make_ready_async() or make_exceptional_async(), which has no coroutine frame
+template <typename T>
+class ready_result {
+    public:
+        template <typename VALUE>
+        explicit ready_result(std::in_place_t, VALUE&& value) : m_result(std::in_place_index<0>, std::forward<VALUE>(value)) {}
+        explicit ready_result(std::exception_ptr eptr) noexcept : m_result(std::in_place_index<1>, std::move(eptr)) {}
+
+        T& result() & {
+            check();
+            return std::get<0>(m_result);
+        }
+        typename async_promise<T>::rvalue_type result() && {
+            check();
+            return std::move(std::get<0>(m_result));
+        }
+
+    private:
+        void check() const {
+            if (m_result.index() == 1) {
+                std::rethrow_exception(std::get<1>(m_result));
+            }
+        }
+        std::variant<T, std::exception_ptr> m_result;
+};
+template <>
+class ready_result<void> {
+    public:
+        explicit ready_result(std::in_place_t) noexcept {}
+        explicit ready_result(std::exception_ptr eptr) noexcept : m_exception(std::move(eptr)) {}
+
+        void result() const {
+            if (m_exception) {
+                std::rethrow_exception(m_exception);
+            }
+        }
+
+    private:
+        std::exception_ptr m_exception;
+};
+template <typename T>
+class ready_result<T&> {
+    public:
+        explicit ready_result(std::in_place_t, T& value) noexcept : m_value(std::addressof(value)) {}
+        explicit ready_result(std::exception_ptr eptr) noexcept : m_value(nullptr), m_exception(std::move(eptr)) {}
+
+        T& result() const {
+            if (m_exception) {
+                std::rethrow_exception(m_exception);
+            }
+            return *m_value;
+        }
+
+    private:
+        T* m_value;
+        std::exception_ptr m_exception;
+};
+
+template <typename T, typename... ARGS>
+ready_result<T>* make_ready_result(ARGS&&... args) {
+    using result_type = ready_result<T>;
+    if constexpr (alignof(result_type) > __STDCPP_DEFAULT_NEW_ALIGNMENT__) {
+        return new result_type(std::forward<ARGS>(args)...);
+    } else {
+        void* memory = ready_pool<sizeof(result_type)>::allocate();
+        try {
+            return new (memory) result_type(std::forward<ARGS>(args)...);
+        } catch (...) {
+            ready_pool<sizeof(result_type)>::deallocate(memory);
+            throw;
+        }
+    }
+}
+template <typename T>
+void release_ready_result(ready_result<T>* result) noexcept {
+    using result_type = ready_result<T>;
+    if constexpr (alignof(result_type) > __STDCPP_DEFAULT_NEW_ALIGNMENT__) {
+        delete result;
+    } else {
+        result->~result_type();
+        ready_pool<sizeof(result_type)>::deallocate(result);
+    }
+}
+
+// the coroutine of an async or, tagged with the lowest bit, its ready_result. keeping the ready_result out of line
+// keeps every async one pointer wide. coroutine frames and ready_results are aligned, so the bit is free.
+template <typename T>
+class async_handle {
+    public:
+        using handle_type = std::coroutine_handle<async_promise<T>>;
+
+        async_handle() noexcept = default;
+        async_handle(std::nullptr_t) noexcept {}
+        async_handle(handle_type coroutine) noexcept : m_bits(reinterpret_cast<std::uintptr_t>(coroutine.address())) {}
+        explicit async_handle(ready_result<T>* ready) noexcept : m_bits(reinterpret_cast<std::uintptr_t>(ready) | ready_tag) {}
+
+        // true only for a coroutine
+        explicit operator bool() const noexcept { return m_bits != 0 && (m_bits & ready_tag) == 0; }
+        handle_type coroutine() const noexcept { return handle_type::from_address(*this ? reinterpret_cast<void*>(m_bits) : nullptr); }
+        ready_result<T>* ready() const noexcept { return m_bits & ready_tag ? reinterpret_cast<ready_result<T>*>(m_bits & ~ready_tag) : nullptr; }
+
+        async_promise<T>& promise() const { return coroutine().promise(); }
+        bool done() const { return coroutine().done(); }
+        void destroy() const { coroutine().destroy(); }
+
+    private:
+        static constexpr std::uintptr_t ready_tag = 1;
+        std::uintptr_t m_bits = 0;
+};
+
 }  // namespace detail
 
 template <typename T>
-class async_base {
+class async_base : public detail::chainable<async<T>> {
     public:
         using promise_type = detail::async_promise<T>;
         using handle_type = std::coroutine_handle<promise_type>;
@@ -282,7 +808,8 @@ class async_base {
         unsigned sn;
 #endif
     protected:
-        handle_type m_coroutine;
+        // the coroutine or the result of make_ready_async()
+        detail::async_handle<T> m_coroutine;
 
         async_base() noexcept : m_coroutine(nullptr) {
 #ifdef _COROUTINE_DEBUG
@@ -296,6 +823,12 @@ class async_base {
             ++async_use_counter;
             sn = ++async_sn_counter;
             // std::println("  create async<>(coroutine) #{}", sn);
+#endif
+        }
+        explicit async_base(detail::ready_result<T>* ready) noexcept : m_coroutine(ready) {
+#ifdef _COROUTINE_DEBUG
+            ++async_use_counter;
+            sn = ++async_sn_counter;
 #endif
         }
         async_base(async_base&& t) noexcept : m_coroutine(t.m_coroutine) {
@@ -311,31 +844,37 @@ class async_base {
 #ifdef _COROUTINE_DEBUG
             --async_use_counter;
             if (m_coroutine) {
-                std::println("async #{} destroyed, also destroy promise #{}", sn, getSNforHandle(m_coroutine));
+                std::println("async #{} destroyed, also destroy promise #{}", sn, getSNforHandle(m_coroutine.coroutine()));
                 if (!m_coroutine.done()) {
-                    std::println("async #{} destroyed, also destroy promise #{} BUT IT'S NOT DONE", sn, getSNforHandle(m_coroutine));
+                    std::println("async #{} destroyed, also destroy promise #{} BUT IT'S NOT DONE", sn, getSNforHandle(m_coroutine.coroutine()));
                 }
             } else {
                 std::println("async #{} destroyed, no promise to destroy", sn);
             }
 #endif
             if (m_coroutine) {
-                if (!m_coroutine.done()) {
-                    m_coroutine.destroy();
+                bool done = m_coroutine.done();
+                m_coroutine.destroy();
+                if (!done && !detail::destroying_scope) {
                     throw unfinished_promise();
                 }
-                m_coroutine.destroy();
+            } else if (auto ready = m_coroutine.ready()) {
+                detail::release_ready_result(ready);
             }
         }
 
         async_base(const async_base&) = delete;
         async_base& operator=(const async_base&) = delete;
 
+        friend class async_scope;
+
     public:
         async_base& operator=(async_base&& other) noexcept {
             if (std::addressof(other) != this) {
                 if (m_coroutine) {
                     m_coroutine.destroy();
+                } else if (auto ready = m_coroutine.ready()) {
+                    detail::release_ready_result(ready);
                 }
                 m_coroutine = other.m_coroutine;
                 other.m_coroutine = nullptr;
@@ -346,22 +885,37 @@ class async_base {
     private:
         struct awaitable_base {
                 handle_type m_coroutine;
+                detail::ready_result<T>* m_ready;
                 unsigned sn;
 #ifdef _COROUTINE_DEBUG
-                awaitable_base(handle_type coroutine, unsigned sn) noexcept : m_coroutine(coroutine), sn(sn) {
+                awaitable_base(handle_type coroutine, detail::ready_result<T>* ready, unsigned sn) noexcept
+                    : m_coroutine(coroutine), m_ready(ready), sn(sn) {
                     ++awaitable_use_counter;
                     // std::println("   create awaitable_base(coroutine) #{}", this->sn);
                 }
                 ~awaitable_base() { --awaitable_use_counter; }
                 bool await_ready() const noexcept {
-                    std::println("awaitable #{} for promise #{}: await_ready() -> false", this->sn, getSNforHandle(m_coroutine));
-                    return false;
+                    if (!m_coroutine) {
+                        std::println("awaitable #{} without promise: await_ready() -> true", this->sn);
+                        return true;
+                    }
+                    std::println("awaitable #{} for promise #{}: await_ready() -> {}", this->sn, getSNforHandle(m_coroutine), m_coroutine.done());
+                    return m_coroutine.done();
                 }
 #else
-                awaitable_base(handle_type coroutine) noexcept : m_coroutine(coroutine) {}
-                bool await_ready() const noexcept { return false; }
+                awaitable_base(handle_type coroutine, detail::ready_result<T>* ready) noexcept : m_coroutine(coroutine), m_ready(ready) {}
+                // a finished coroutine or a ready result is returned without suspending
+                bool await_ready() const noexcept { return !m_coroutine || m_coroutine.done(); }
 #endif
-                bool await_suspend(std::coroutine_handle<> parent) noexcept {
+                // the result of make_ready_async(), throws broken_promise for a moved from async
+                detail::ready_result<T>& ready() const {
+                    if (!m_ready) {
+                        throw broken_promise{};
+                    }
+                    return *m_ready;
+                }
+                template <typename PROMISE>
+                bool await_suspend(std::coroutine_handle<PROMISE> parent) noexcept {
 #ifdef _COROUTINE_DEBUG
                     std::println("awaitable #{} for promise #{}: await_suspend() -> set promise #{} as parent and suspend", this->sn,
                                  getSNforHandle(m_coroutine), getSNforHandle(parent));
@@ -377,7 +931,7 @@ class async_base {
                     using awaitable_base::awaitable_base;
                     decltype(auto) await_resume() {
                         if (!this->m_coroutine) {
-                            throw broken_promise{};
+                            return this->ready().result();
                         }
 #ifdef _COROUTINE_DEBUG
                         std::println("awaitable #{} for co_await()&: await_resume() -> return value from promise #{}", this->sn,
@@ -388,10 +942,10 @@ class async_base {
             };
 #ifdef _COROUTINE_DEBUG
             auto asn = ++awaitable_sn_counter;
-            std::println("async #{} co_await&: create awaitable #{} for promise #{}", sn, asn, getSNforHandle(m_coroutine));
-            return awaitable{m_coroutine, asn};
+            std::println("async #{} co_await&: create awaitable #{} for promise #{}", sn, asn, m_coroutine ? getSNforHandle(m_coroutine.coroutine()) : 0);
+            return awaitable{m_coroutine.coroutine(), m_coroutine.ready(), asn};
 #else
-            return awaitable{m_coroutine};
+            return awaitable{m_coroutine.coroutine(), m_coroutine.ready()};
 #endif
         }
         auto operator co_await() const&& noexcept {
@@ -399,7 +953,7 @@ class async_base {
                     using awaitable_base::awaitable_base;
                     decltype(auto) await_resume() {
                         if (!this->m_coroutine) {
-                            throw broken_promise{};
+                            return std::move(this->ready()).result();
                         }
 #ifdef _COROUTINE_DEBUG
                         std::println("awaitable #{} for co_await()&&: await_resume() -> return value from promise #{}", this->sn,
@@ -410,19 +964,34 @@ class async_base {
             };
 #ifdef _COROUTINE_DEBUG
             auto asn = ++awaitable_sn_counter;
-            std::println("async #{} co_await&&: create awaitable #{} for promise #{}", sn, asn, getSNforHandle(m_coroutine));
-            return awaitable{m_coroutine, asn};
+            std::println("async #{} co_await&&: create awaitable #{} for promise #{}", sn, asn, m_coroutine ? getSNforHandle(m_coroutine.coroutine()) : 0);
+            return awaitable{m_coroutine.coroutine(), m_coroutine.ready(), asn};
 #else
-            return awaitable{m_coroutine};
+            return awaitable{m_coroutine.coroutine(), m_coroutine.ready()};
 #endif
         }
 
         void no_wait() {
-            if (!m_coroutine.done()) {
+            if (m_coroutine && !m_coroutine.done()) {
                 m_coroutine.promise().drop = true;
                 m_coroutine = nullptr;
             }
         }
+
+        // used by the adapters returned from map(), and_then() and or_else()
+        bool done() const noexcept { return !m_coroutine || m_coroutine.done(); }
+        // returns false when the async has already finished and the handler won't be called
+        bool on_complete(detail::completion* handler) noexcept { return m_coroutine && m_coroutine.promise().set_completion(handler); }
+        decltype(auto) result() {
+            if (!m_coroutine) {
+                auto ready = m_coroutine.ready();
+                if (!ready) {
+                    throw broken_promise{};
+                }
+                return std::move(*ready).result();
+            }
+            return std::move(m_coroutine.promise()).result();
+        }
 };
 
 template <typename T = void>
@@ -435,10 +1004,12 @@ class [[nodiscard]] async : public async_base<T> {
     public:
         async() noexcept : async_base<T>() {}
         explicit async(handle_type coroutine) noexcept : async_base<T>(coroutine) {}
-        async(async&& t) noexcept : async_base<T>(t.m_coroutine) {}
+        explicit async(detail::ready_result<T>* ready) noexcept : async_base<T>(ready) {}
+        async(async&& t) noexcept : async_base<T>(std::move(t)) {}
+        async& operator=(async&& t) noexcept = default;
 
         async<T>& then(const std::function<void(T response)>& callback) {
-            handle_type& m_coroutine = this->m_coroutine;
+            auto& m_coroutine = this->m_coroutine;
             if (m_coroutine) {
                 if (!m_coroutine.done()) {
                     m_coroutine.promise().then = callback;
@@ -447,11 +1018,13 @@ class [[nodiscard]] async : public async_base<T> {
                 } else {
                     callback(m_coroutine.promise().result());
                 }
+            } else if (auto ready = m_coroutine.ready()) {
+                callback(ready->result());
             }
             return *this;
         }
         async<T>& thenOrCatch(std::function<void(T response)> response_cb, std::function<void(std::exception_ptr eptr)> exception_cb) {
-            handle_type& m_coroutine = this->m_coroutine;
+            auto& m_coroutine = this->m_coroutine;
             if (m_coroutine) {
                 if (!m_coroutine.done()) {
 #ifdef _COROUTINE_DEBUG
@@ -471,6 +1044,12 @@ class [[nodiscard]] async : public async_base<T> {
                         exception_cb(std::current_exception());
                     }
                 }
+            } else if (auto ready = m_coroutine.ready()) {
+                try {
+                    response_cb(ready->result());
+                } catch (...) {
+                    exception_cb(std::current_exception());
+                }
 #ifdef _COROUTINE_DEBUG
             } else {
                 std::println("async<T>::thenOrCatch(): no coroutine");
@@ -489,25 +1068,27 @@ class [[nodiscard]] async<void> : public async_base<void> {
     public:
         async() noexcept : async_base<void>() {}
         explicit async(handle_type coroutine) noexcept : async_base<void>(coroutine) {}
-        async(async&& t) noexcept : async_base<void>(t.m_coroutine) {}
+        explicit async(detail::ready_result<void>* ready) noexcept : async_base<void>(ready) {}
+        async(async&& t) noexcept : async_base<void>(std::move(t)) {}
+        async& operator=(async&& t) noexcept = default;
 
         async<void>& then(std::function<void()> callback) {
-            handle_type& m_coroutine = this->m_coroutine;
-            if (!m_coroutine.done()) {
+            auto& m_coroutine = this->m_coroutine;
+            if (m_coroutine && !m_coroutine.done()) {
                 m_coroutine.promise().drop = true;
                 m_coroutine.promise().then = callback;
                 m_coroutine = nullptr;
-            } else {
+            } else if (m_coroutine || m_coroutine.ready()) {
                 callback();
             }
             return *this;
         }
         async<void>& thenOrCatch(std::function<void()> response_cb, std::function<void(std::exception_ptr eptr)> exception_cb) {
-            handle_type& m_coroutine = this->m_coroutine;
+            auto& m_coroutine = this->m_coroutine;
             if (m_coroutine) {
                 if (!m_coroutine.done()) {
 #ifdef _COROUTINE_DEBUG
-                    std::println("async<void>::thenOrCatch(): decouple from promise #{} and set fail callback", getSNforHandle(m_coroutine));
+                    std::println("async<void>::thenOrCatch(): decouple from promise #{} and set fail callback", getSNforHandle(m_coroutine.coroutine()));
 #endif
                     m_coroutine.promise().then = response_cb;
                     m_coroutine.promise().fail = exception_cb;
@@ -524,6 +1105,13 @@ class [[nodiscard]] async<void> : public async_base<void> {
                         exception_cb(std::current_exception());
                     }
                 }
+            } else if (auto ready = m_coroutine.ready()) {
+                try {
+                    ready->result();
+                    response_cb();
+                } catch (...) {
+                    exception_cb(std::current_exception());
+                }
 #ifdef _COROUTINE_DEBUG
             } else {
                 std::println("async<void>::thenOrCatch(): no coroutine");
@@ -533,10 +1121,33 @@ class [[nodiscard]] async<void> : public async_base<void> {
         }
 };
 
+// an async which is finished with the value without having a coroutine frame, e.g. for cache hits
+template <typename T>
+async<std::decay_t<T>> make_ready_async(T&& value) {
+    return async<std::decay_t<T>>{detail::make_ready_result<std::decay_t<T>>(std::in_place, std::forward<T>(value))};
+}
+template <typename T>
+async<T&> make_ready_async(std::reference_wrapper<T> value) {
+    return async<T&>{detail::make_ready_result<T&>(std::in_place, value.get())};
+}
+inline async<> make_ready_async() { return async<>{detail::make_ready_result<void>(std::in_place)}; }
+
+// an async which is finished with the exception without having a coroutine frame
+template <typename T = void>
+async<T> make_exceptional_async(std::exception_ptr eptr) {
+    return async<T>{detail::make_ready_result<T>(std::move(eptr))};
+}
+template <typename T = void, typename E>
+    requires(!std::is_same_v<std::decay_t<E>, std::exception_ptr>)
+async<T> make_exceptional_async(E&& exception) {
+    return make_exceptional_async<T>(std::make_exception_ptr(std::forward<E>(exception)));
+}
+
 namespace detail {
 
 template <typename T>
-async<T> async_promise<T>::get_return_object() noexcept {
+async<T> async_promise<T>::get_return_object(const std::source_location where) noexcept {
+    set_function(where);
     auto t = async<T>{std::coroutine_handle<async_promise>::from_promise(*this)};
 #ifdef _COROUTINE_DEBUG
     std::println("before entering function: created async<T> #{} with promise #{}", t.sn, sn);
@@ -544,7 +1155,8 @@ async<T> async_promise<T>::get_return_object() noexcept {
     return t;
 }
 
-inline async<void> async_promise<void>::get_return_object() noexcept {
+inline async<void> async_promise<void>::get_return_object(const std::source_location where) noexcept {
+    set_function(where);
     auto t = async<void>{std::coroutine_handle<async_promise>::from_promise(*this)};
 #ifdef _COROUTINE_DEBUG
     std::println("before entering function: created async<void> #{} with promise #{}", t.sn, sn);
@@ -553,7 +1165,8 @@ inline async<void> async_promise<void>::get_return_object() noexcept {
 }
 
 template <typename T>
-async<T&> async_promise<T&>::get_return_object() noexcept {
+async<T&> async_promise<T&>::get_return_object(const std::source_location where) noexcept {
+    set_function(where);
     auto t = async<T&>{std::coroutine_handle<async_promise>::from_promise(*this)};
 #ifdef _COROUTINE_DEBUG
     std::println("before entering function: created async<T&> #{} with promise #{}", t.sn, sn);
@@ -561,8 +1174,609 @@ async<T&> async_promise<T&>::get_return_object() noexcept {
     return t;
 }
 
+// co_await on the adapters returned by map(), and_then() and or_else()
+template <typename S>
+class chain_awaiter : completion {
+    public:
+        explicit chain_awaiter(S&& source) noexcept : m_source(std::move(source)) {}
+        bool await_ready() noexcept { return m_source.done(); }
+        bool await_suspend(std::coroutine_handle<> parent) noexcept {
+            m_parent = parent;
+            return m_source.on_complete(this);
+        }
+        decltype(auto) await_resume() { return m_source.result(); }
+
+    private:
+        std::coroutine_handle<> complete() noexcept override { return m_parent; }
+
+        S m_source;
+        std::coroutine_handle<> m_parent;
+};
+
+template <typename SELF>
+class adapter_base : public chainable<SELF> {
+    public:
+        auto operator co_await() && noexcept { return chain_awaiter<SELF>{static_cast<SELF&&>(*this)}; }
+};
+
+// result type of S::result() with rvalue references decayed into values
+template <typename S>
+using chain_result_t = std::conditional_t<std::is_lvalue_reference_v<decltype(std::declval<S&>().result())>, decltype(std::declval<S&>().result()),
+                                          std::remove_cvref_t<decltype(std::declval<S&>().result())>>;
+
+template <typename S, typename F>
+class map_adapter : public adapter_base<map_adapter<S, F>> {
+    public:
+        template <typename FN>
+        map_adapter(S&& source, FN&& fn) : m_source(std::move(source)), m_fn(std::forward<FN>(fn)) {}
+
+        bool done() noexcept { return m_source.done(); }
+        bool on_complete(completion* handler) noexcept { return m_source.on_complete(handler); }
+        decltype(auto) result() {
+            if constexpr (std::is_void_v<chain_result_t<S>>) {
+                m_source.result();
+                return std::invoke(m_fn);
+            } else {
+                return std::invoke(m_fn, m_source.result());
+            }
+        }
+
+    private:
+        S m_source;
+        F m_fn;
+};
+
+template <typename S, typename F>
+class or_else_adapter : public adapter_base<or_else_adapter<S, F>> {
+    public:
+        template <typename FN>
+        or_else_adapter(S&& source, FN&& fn) : m_source(std::move(source)), m_fn(std::forward<FN>(fn)) {}
+
+        bool done() noexcept { return m_source.done(); }
+        bool on_complete(completion* handler) noexcept { return m_source.on_complete(handler); }
+        chain_result_t<S> result() {
+            try {
+                return m_source.result();
+            } catch (...) {
+                return std::invoke(m_fn, std::current_exception());
+            }
+        }
+
+    private:
+        S m_source;
+        F m_fn;
+};
+
+// once the source is done, fn(result) is called from the source's final_suspend()
+// and the async returned by it takes over the source's completion
+template <typename S, typename F>
+class and_then_adapter : public adapter_base<and_then_adapter<S, F>>, completion {
+        using next_type = typename std::conditional_t<std::is_void_v<chain_result_t<S>>, std::invoke_result<F>, std::invoke_result<F, chain_result_t<S>>>::type;
+
+    public:
+        template <typename FN>
+        and_then_adapter(S&& source, FN&& fn) : m_source(std::move(source)), m_fn(std::forward<FN>(fn)) {}
+        and_then_adapter(and_then_adapter&&) = default;
+
+        bool done() noexcept {
+            if (!m_next && !m_exception) {
+                if (!m_source.done()) {
+                    return false;
+                }
+                start();
+            }
+            return m_exception || m_next->done();
+        }
+        bool on_complete(completion* handler) noexcept {
+            m_completion = handler;
+            if (!m_next && !m_exception) {
+                if (m_source.on_complete(this)) {
+                    return true;
+                }
+                start();
+            }
+            return !m_exception && m_next->on_complete(handler);
+        }
+        decltype(auto) result() {
+            if (m_exception) {
+                std::rethrow_exception(m_exception);
+            }
+            return m_next->result();
+        }
+
+    private:
+        void start() noexcept {
+            try {
+                if constexpr (std::is_void_v<chain_result_t<S>>) {
+                    m_source.result();
+                    m_next.emplace(std::invoke(m_fn));
+                } else {
+                    m_next.emplace(std::invoke(m_fn, m_source.result()));
+                }
+            } catch (...) {
+                m_exception = std::current_exception();
+            }
+        }
+        std::coroutine_handle<> complete() noexcept override {
+            start();
+            if (m_exception || !m_next->on_complete(m_completion)) {
+                return m_completion->complete();
+            }
+            return std::noop_coroutine();
+        }
+
+        S m_source;
+        F m_fn;
+        std::optional<next_type> m_next;
+        std::exception_ptr m_exception;
+        completion* m_completion = nullptr;
+};
+
+}  // namespace detail
+
+// a queue of functions to be executed by the thread calling run_until_complete(), those with a
+// higher priority first. to prevent starvation, a function which had to wait for more than
+// 'aging' other functions to be run is run next.
+class run_queue {
+    public:
+        explicit run_queue(unsigned aging = 64) noexcept : m_aging(aging) {}
+
+        void post(std::function<void()> fn, int priority = 0) {
+            {
+                std::lock_guard lock(m_mutex);
+                m_levels[priority].push_back({std::move(fn), m_posted++, m_runs});
+                ++m_size;
+            }
+            m_cv.notify_one();
+        }
+    private:
+        struct schedule_awaiter {
+                run_queue* queue;
+                bool await_ready() const noexcept { return false; }
+                template <typename PROMISE>
+                void await_suspend(std::coroutine_handle<PROMISE> continuation) {
+                    int priority = 0;
+                    if constexpr (std::is_base_of_v<detail::async_promise_base, PROMISE>) {
+                        priority = continuation.promise().priority();
+                    }
+                    queue->post([continuation] { continuation.resume(); }, priority);
+                }
+                void await_resume() const noexcept {}
+        };
+
+    public:
+        // co_await queue.schedule() continues the coroutine on the thread draining the queue
+        schedule_awaiter schedule() noexcept { return {this}; }
+        // the queue running a function on the calling thread or nullptr
+        static run_queue* current() noexcept { return s_current; }
+        // run the next function, returns false when the queue was empty
+        bool run_one() {
+            std::function<void()> fn;
+            {
+                std::lock_guard lock(m_mutex);
+                if (m_size == 0) {
+                    return false;
+                }
+                fn = pop();
+            }
+            running use(this);
+            fn();
+            return true;
+        }
+        // run the queued functions until done() returns true, call wake() after done() has changed
+        template <typename DONE>
+        void run_until(DONE done) {
+            running use(this);
+            while (true) {
+                std::function<void()> fn;
+                {
+                    std::unique_lock lock(m_mutex);
+                    m_cv.wait(lock, [&] { return done() || m_size != 0; });
+                    if (done()) {
+                        return;
+                    }
+                    fn = pop();
+                }
+                fn();
+            }
+        }
+        void wake() {
+            std::lock_guard lock(m_mutex);
+            m_cv.notify_all();
+        }
+
+    private:
+        // sets current() while the queue runs functions
+        struct running {
+                run_queue* outer;
+                explicit running(run_queue* queue) noexcept : outer(std::exchange(s_current, queue)) {}
+                ~running() { s_current = outer; }
+        };
+        struct entry {
+                std::function<void()> fn;
+                std::uint64_t posted;  // sequence number
+                std::uint64_t runs;    // m_runs when posted
+        };
+        // called with m_mutex locked and at least one entry queued
+        std::function<void()> pop() {
+            auto starving = [&](const entry& e) { return m_runs - e.runs > m_aging; };
+            auto next = m_levels.end();
+            for (auto it = m_levels.begin(); it != m_levels.end(); ++it) {
+                if (it->second.empty()) {
+                    continue;
+                }
+                auto& front = it->second.front();
+                if (next == m_levels.end() ||
+                    (starving(front) && (!starving(next->second.front()) || front.posted < next->second.front().posted))) {
+                    next = it;
+                }
+            }
+            auto fn = std::move(next->second.front().fn);
+            next->second.pop_front();
+            --m_size;
+            ++m_runs;
+            return fn;
+        }
+
+        std::mutex m_mutex;
+        std::condition_variable m_cv;
+        std::map<int, std::deque<entry>, std::greater<int>> m_levels;
+        std::size_t m_size = 0;
+        std::uint64_t m_posted = 0;
+        std::uint64_t m_runs = 0;
+        unsigned m_aging;
+        static inline thread_local run_queue* s_current = nullptr;
+};
+
+namespace detail {
+
+// lives on the stack of the waiting thread, which returns as soon as it sees m_done. complete() must not
+// touch it afterwards, hence the mutex held across notify_one().
+class sync_wait_completion : public completion {
+    public:
+        explicit sync_wait_completion(run_queue* queue = nullptr) noexcept : m_queue(queue) {}
+        bool done() const noexcept { return m_done.load(std::memory_order_acquire); }
+        void wait() {
+            std::unique_lock lock(m_mutex);
+            m_cv.wait(lock, [this] { return done(); });
+        }
+        std::coroutine_handle<> complete() noexcept override {
+            if (auto queue = m_queue) {
+                m_done.store(true, std::memory_order_release);
+                queue->wake();
+            } else {
+                std::lock_guard lock(m_mutex);
+                m_done.store(true, std::memory_order_release);
+                m_cv.notify_one();
+            }
+            return std::noop_coroutine();
+        }
+
+    private:
+        run_queue* m_queue;
+        std::atomic<bool> m_done = false;
+        std::mutex m_mutex;
+        std::condition_variable m_cv;
+};
+
 }  // namespace detail
 
+// block the calling thread until the async (or an adapter from map(), and_then() or or_else())
+// has been finished by another thread and return its result or rethrow its exception
+template <typename S>
+detail::chain_result_t<S> sync_wait(S&& source) {
+    detail::sync_wait_completion completion;
+    if (source.on_complete(&completion)) {
+        completion.wait();
+    }
+    return source.result();
+}
+
+// like sync_wait() but executes the functions posted to the queue while waiting
+template <typename S>
+detail::chain_result_t<S> run_until_complete(run_queue& queue, S&& source) {
+    detail::sync_wait_completion completion(&queue);
+    if (source.on_complete(&completion)) {
+        queue.run_until([&] { return completion.done(); });
+    }
+    return source.result();
+}
+
+// owns the coroutines spawned into it until they are finished, destroying the scope
+// also destroys the unfinished ones
+class async_scope {
+    public:
+        async_scope() = default;
+        async_scope(const async_scope&) = delete;
+        async_scope& operator=(const async_scope&) = delete;
+        ~async_scope() {
+            bool destroying = detail::destroying_scope;
+            detail::destroying_scope = true;
+            while (m_children) {
+                auto child = m_children;
+                unlink(child);
+                std::coroutine_handle<detail::async_promise_base>::from_promise(*child).destroy();
+            }
+            detail::destroying_scope = destroying;
+        }
+
+        template <typename T>
+        void spawn(async<T>&& child) {
+            if (child.done()) {
+                try {
+                    child.result();
+                } catch (...) {
+                    failed(std::current_exception());
+                }
+                return;
+            }
+            auto& promise = child.m_coroutine.promise();
+            promise.fail = [this](std::exception_ptr eptr) { failed(eptr); };
+            promise.m_scope = this;
+            promise.m_next_child = m_children;
+            if (m_children) {
+                m_children->m_prev_child = &promise;
+            }
+            m_children = &promise;
+            ++m_size;
+            child.m_coroutine = nullptr;
+        }
+
+        bool empty() const noexcept { return m_children == nullptr; }
+        std::size_t size() const noexcept { return m_size; }
+
+        // co_await scope.join() waits for all children to finish and rethrows the first exception thrown by them
+        auto join() noexcept {
+            struct awaiter {
+                    async_scope* scope;
+                    bool await_ready() const noexcept { return scope->empty(); }
+                    void await_suspend(std::coroutine_handle<> joiner) noexcept { scope->m_joiner = joiner; }
+                    void await_resume() {
+                        if (auto eptr = std::exchange(scope->m_exception, nullptr)) {
+                            std::rethrow_exception(eptr);
+                        }
+                    }
+            };
+            return awaiter{this};
+        }
+
+    private:
+        friend std::coroutine_handle<> detail::scope_finished(detail::async_promise_base& promise, std::coroutine_handle<> coro) noexcept;
+
+        void failed(std::exception_ptr eptr) noexcept {
+            if (!m_exception) {
+                m_exception = eptr;
+            }
+        }
+        void unlink(detail::async_promise_base* child) noexcept {
+            if (child->m_prev_child) {
+                child->m_prev_child->m_next_child = child->m_next_child;
+            } else {
+                m_children = child->m_next_child;
+            }
+            if (child->m_next_child) {
+                child->m_next_child->m_prev_child = child->m_prev_child;
+            }
+            child->m_scope = nullptr;
+            --m_size;
+        }
+
+        detail::async_promise_base* m_children = nullptr;
+        std::size_t m_size = 0;
+        std::coroutine_handle<> m_joiner;
+        std::exception_ptr m_exception;
+};
+
+namespace detail {
+
+inline std::coroutine_handle<> scope_finished(async_promise_base& promise, std::coroutine_handle<> coro) noexcept {
+    auto scope = promise.m_scope;
+    scope->unlink(&promise);
+    coro.destroy();
+    if (scope->empty() && scope->m_joiner) {
+        return std::exchange(scope->m_joiner, nullptr);
+    }
+    return std::noop_coroutine();
+}
+
+}  // namespace detail
+
+// what a C callback needs to resume the coroutine suspended in co_await on_callback<T>(start):
+// start(callback_result<T>*) passes it as the callback's user pointer and the callback calls
+// set_value() and resume() or the complete() trampoline. no lookup is involved.
+template <typename T>
+class callback_result {
+    public:
+        template <typename... ARGS>
+        void set_value(ARGS&&... args) {
+            m_value.emplace(std::forward<ARGS>(args)...);
+        }
+        void set_exception(std::exception_ptr eptr) noexcept { m_exception = eptr; }
+        void resume() {
+            // when the callback was invoked from within start(), await_suspend() doesn't suspend
+            if (m_state.exchange(completed, std::memory_order_acq_rel) == suspended) {
+                m_coroutine.resume();
+            }
+        }
+        static void complete(void* user, T value) {
+            auto self = static_cast<callback_result*>(user);
+            self->set_value(std::move(value));
+            self->resume();
+        }
+
+    protected:
+        enum state { starting, suspended, completed };
+        T take() {
+            if (m_exception) {
+                std::rethrow_exception(m_exception);
+            }
+            return std::move(*m_value);
+        }
+
+        std::coroutine_handle<> m_coroutine;
+        std::atomic<state> m_state = starting;
+        std::exception_ptr m_exception;
+        std::optional<T> m_value;
+};
+
+template <>
+class callback_result<void> {
+    public:
+        void set_value() noexcept {}
+        void set_exception(std::exception_ptr eptr) noexcept { m_exception = eptr; }
+        void resume() {
+            if (m_state.exchange(completed, std::memory_order_acq_rel) == suspended) {
+                m_coroutine.resume();
+            }
+        }
+        static void complete(void* user) { static_cast<callback_result*>(user)->resume(); }
+
+    protected:
+        enum state { starting, suspended, completed };
+        void take() {
+            if (m_exception) {
+                std::rethrow_exception(m_exception);
+            }
+        }
+
+        std::coroutine_handle<> m_coroutine;
+        std::atomic<state> m_state = starting;
+        std::exception_ptr m_exception;
+};
+
+template <typename T, typename START>
+class callback_awaitable : public callback_result<T> {
+    public:
+        explicit callback_awaitable(START start) : m_start(std::move(start)) {}
+        callback_awaitable(callback_awaitable&&) = delete;
+        bool await_ready() const noexcept { return false; }
+        bool await_suspend(std::coroutine_handle<> coroutine) {
+            this->m_coroutine = coroutine;
+            std::invoke(m_start, static_cast<callback_result<T>*>(this));
+            return this->m_state.exchange(callback_result<T>::suspended, std::memory_order_acq_rel) != callback_result<T>::completed;
+        }
+        T await_resume() { return this->take(); }
+
+    private:
+        START m_start;
+};
+
+template <typename T, typename START>
+callback_awaitable<T, std::decay_t<START>> on_callback(START&& start) {
+    return callback_awaitable<T, std::decay_t<START>>{std::forward<START>(start)};
+}
+
+namespace detail {
+
+// the state shared by the copies of a shared_async
+template <typename T>
+class shared_state : public completion, public std::enable_shared_from_this<shared_state<T>> {
+    public:
+        struct awaiter {
+                std::shared_ptr<shared_state> state;
+                awaiter* next = nullptr;
+                std::coroutine_handle<> coroutine;
+                bool await_ready() const noexcept { return !state || state->m_done; }
+                void await_suspend(std::coroutine_handle<> awaiting) noexcept {
+                    coroutine = awaiting;
+                    state->push(this);
+                }
+                decltype(auto) await_resume() const {
+                    if (!state) {
+                        throw broken_promise{};
+                    }
+                    return state->result();
+                }
+        };
+
+        explicit shared_state(async<T>&& source) : m_source(std::move(source)) {}
+        ~shared_state() {
+            if (!m_done) {
+                m_source.on_complete(nullptr);
+                m_source.no_wait();
+            }
+        }
+        void start() {
+            if (!m_source.on_complete(this)) {
+                store();
+            }
+        }
+        bool done() const noexcept { return m_done; }
+        bool failed() const noexcept { return m_exception != nullptr; }
+        std::conditional_t<std::is_void_v<T>, void, std::add_lvalue_reference_t<const T>> result() const {
+            if (m_exception) {
+                std::rethrow_exception(m_exception);
+            }
+            if constexpr (!std::is_void_v<T>) {
+                return *m_value;
+            }
+        }
+
+    private:
+        void push(awaiter* a) noexcept {
+            if (m_last) {
+                m_last->next = a;
+            } else {
+                m_first = a;
+            }
+            m_last = a;
+        }
+        void store() noexcept {
+            try {
+                if constexpr (std::is_void_v<T>) {
+                    m_source.result();
+                } else {
+                    m_value.emplace(m_source.result());
+                }
+            } catch (...) {
+                m_exception = std::current_exception();
+            }
+            m_done = true;
+        }
+        // resume all awaiters, the last one by returning it to the source's final_suspend()
+        std::coroutine_handle<> complete() noexcept override {
+            store();
+            auto keep_alive = this->shared_from_this();
+            m_source = async<T>{};
+            auto a = std::exchange(m_first, nullptr);
+            m_last = nullptr;
+            while (a && a->next) {
+                auto next = a->next;
+                a->coroutine.resume();
+                a = next;
+            }
+            return a ? a->coroutine : std::noop_coroutine();
+        }
+
+        async<T> m_source;
+        bool m_done = false;
+        std::conditional_t<std::is_void_v<T>, bool, std::optional<T>> m_value;
+        std::exception_ptr m_exception;
+        awaiter* m_first = nullptr;
+        awaiter* m_last = nullptr;
+};
+
+}  // namespace detail
+
+// an async which can be awaited by any number of coroutines, e.g. to share one request among many
+// identical ones. the result is stored once and every co_await returns a const reference to it.
+template <typename T = void>
+class shared_async {
+    public:
+        shared_async() = default;
+        explicit shared_async(async<T>&& source) : m_state(std::make_shared<detail::shared_state<T>>(std::move(source))) { m_state->start(); }
+
+        bool valid() const noexcept { return m_state != nullptr; }
+        // like async, a default constructed shared_async is done and throws broken_promise when awaited
+        bool done() const noexcept { return !m_state || m_state->done(); }
+        // done with an exception
+        bool failed() const noexcept { return m_state && m_state->failed(); }
+        auto operator co_await() const noexcept { return typename detail::shared_state<T>::awaiter{m_state, nullptr, {}}; }
+
+    private:
+        std::shared_ptr<detail::shared_state<T>> m_state;
+};
+
 class signal {
     std::coroutine_handle<detail::async_promise_base> continuation;
     class awaiter {
@@ -597,6 +1811,12 @@ class interlock {
         class awaiter {
             public:
                 awaiter(K id, interlock* _this) : id(id), _this(_this) {}
+                // the coroutine was destroyed while being suspended, e.g. by ~async_scope()
+                ~awaiter() {
+                    if (suspended) {
+                        _this->m_suspended.erase(id);
+                    }
+                }
                 bool await_ready() const noexcept { return false; }
                 template <typename T>
                 bool await_suspend(std::coroutine_handle<detail::async_promise<T>> awaitingCoroutine) noexcept {
@@ -604,12 +1824,14 @@ class interlock {
                     std::println("interlock::awaitable::await_suspend()");
 #endif
                     _this->m_suspended[id] = *((std::coroutine_handle<detail::async_promise_base>*)&awaitingCoroutine);
+                    suspended = true;
                     return true;
                 }
                 V await_resume() {
 #ifdef _COROUTINE_DEBUG
                     std::println("interlock::awaitable::await_resume() return result");
 #endif
+                    suspended = false;
                     auto it = _this->m_result.find(id);
                     if (it == _this->m_result.end()) {
                         throw broken_resume("broken resume: did not find value");
@@ -620,13 +1842,19 @@ class interlock {
             private:
                 K id;
                 interlock* _this;
+                bool suspended = false;
         };
 
         // TODO: use only one map
         std::map<K, std::coroutine_handle<detail::async_promise_base>> m_suspended;
         std::map<K, V> m_result;
+        run_queue* m_queue = nullptr;
 
     public:
+        interlock() = default;
+        // resume() posts the resumption to the queue with the priority of the suspended coroutine
+        explicit interlock(run_queue* queue) noexcept : m_queue(queue) {}
+
         inline bool empty() { return m_suspended.empty(); }
         inline auto begin() { return m_suspended.begin(); }
         inline auto end() { return m_suspended.end(); }
@@ -640,6 +1868,10 @@ class interlock {
             m_suspended.erase(it);
             if (!continuation.done()) {
                 this->m_result[id] = result;
+                if (m_queue) {
+                    m_queue->post([continuation] { continuation.resume(); }, continuation.promise().priority());
+                    return;
+                }
 #ifdef _COROUTINE_DEBUG
                 std::println("interlock::resume() -> resume promise #{}", getSNforHandle(continuation));
 #endif
@@ -648,4 +1880,140 @@ class interlock {
         }
 };
 
+// the key allocated by slot_interlock::suspend(), valid until the value has been received
+struct slot_key {
+        std::uint32_t index;
+        std::uint32_t generation;
+        bool operator==(const slot_key&) const = default;
+        // e.g. to be sent along with a request and to be returned with the response
+        std::uint64_t id() const noexcept { return (std::uint64_t(generation) << 32) | index; }
+        static slot_key from_id(std::uint64_t id) noexcept { return {std::uint32_t(id), std::uint32_t(id >> 32)}; }
+};
+
+// like interlock but suspend() allocates the key, e.g. to correlate requests and responses:
+//
+//   auto response = responses.suspend();
+//   send(request, response.key());
+//   auto value = co_await response;
+//
+// the keys are indices into a vector of slots along with a generation, so resume(key, value) is an array access
+// instead of a tree walk. resuming a key which has already been resumed or whose coroutine has been destroyed
+// throws broken_resume. freed slots are reused last in, first out.
+template <typename V>
+class slot_interlock {
+        static constexpr std::uint32_t none = ~std::uint32_t(0);
+        struct slot {
+                std::uint32_t generation = 0;
+                std::uint32_t next_free = none;
+                bool used = false;
+                int priority = 0;
+                std::coroutine_handle<> continuation;
+                std::optional<V> value;
+        };
+
+    public:
+        class awaiter {
+            public:
+                awaiter(slot_interlock* _this, slot_key key) noexcept : m_this(_this), m_key(key) {}
+                awaiter(awaiter&& other) noexcept : m_this(std::exchange(other.m_this, nullptr)), m_key(other.m_key) {}
+                awaiter& operator=(awaiter&&) = delete;
+                // frees the slot
+                ~awaiter() {
+                    if (m_this) {
+                        m_this->release(m_key.index);
+                    }
+                }
+
+                slot_key key() const noexcept { return m_key; }
+
+                // resume() might have been called before co_await
+                bool await_ready() const noexcept { return m_this->m_slots[m_key.index].value.has_value(); }
+                template <typename PROMISE>
+                void await_suspend(std::coroutine_handle<PROMISE> awaitingCoroutine) noexcept {
+#ifdef _COROUTINE_DEBUG
+                    std::println("slot_interlock::awaitable::await_suspend()");
+#endif
+                    auto& slot = m_this->m_slots[m_key.index];
+                    slot.continuation = awaitingCoroutine;
+                    if constexpr (std::is_base_of_v<detail::async_promise_base, PROMISE>) {
+                        slot.priority = awaitingCoroutine.promise().priority();
+                    }
+                }
+                V await_resume() {
+#ifdef _COROUTINE_DEBUG
+                    std::println("slot_interlock::awaitable::await_resume() return result");
+#endif
+                    return std::move(*m_this->m_slots[m_key.index].value);
+                }
+
+            private:
+                slot_interlock* m_this;
+                slot_key m_key;
+        };
+
+        slot_interlock() = default;
+        // resume() posts the resumption to the queue with the priority of the suspended coroutine
+        explicit slot_interlock(run_queue* queue) noexcept : m_queue(queue) {}
+        slot_interlock(const slot_interlock&) = delete;
+        slot_interlock& operator=(const slot_interlock&) = delete;
+
+        bool empty() const noexcept { return m_size == 0; }
+        // the number of allocated keys
+        std::size_t size() const noexcept { return m_size; }
+
+        awaiter suspend() {
+            std::uint32_t index = m_free;
+            if (index != none) {
+                m_free = m_slots[index].next_free;
+            } else {
+                index = static_cast<std::uint32_t>(m_slots.size());
+                m_slots.emplace_back();
+            }
+            auto& slot = m_slots[index];
+            slot.used = true;
+            ++m_size;
+            return {this, {index, slot.generation}};
+        }
+        void resume(slot_key key, V result) {
+            if (key.index >= m_slots.size()) {
+                throw broken_resume("slot_interlock::resume(...): did not find key");
+            }
+            auto& slot = m_slots[key.index];
+            if (!slot.used || slot.generation != key.generation || slot.value) {
+                throw broken_resume("slot_interlock::resume(...): stale key");
+            }
+            slot.value.emplace(std::move(result));
+            // the coroutine might allocate new slots, so 'slot' must not be used after resuming it
+            auto continuation = std::exchange(slot.continuation, nullptr);
+            if (!continuation) {
+                return;
+            }
+            if (m_queue) {
+                m_queue->post([continuation] { continuation.resume(); }, slot.priority);
+                return;
+            }
+#ifdef _COROUTINE_DEBUG
+            std::println("slot_interlock::resume() -> resume coroutine");
+#endif
+            continuation.resume();
+        }
+
+    private:
+        void release(std::uint32_t index) noexcept {
+            auto& slot = m_slots[index];
+            slot.used = false;
+            ++slot.generation;
+            slot.continuation = nullptr;
+            slot.value.reset();
+            slot.next_free = m_free;
+            m_free = index;
+            --m_size;
+        }
+
+        std::vector<slot> m_slots;
+        std::uint32_t m_free = none;  // top of the stack of free slots, linked by next_free
+        std::size_t m_size = 0;
+        run_queue* m_queue = nullptr;
+};
+
 }  // namespace cppasync
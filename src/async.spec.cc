@@ -1,8 +1,18 @@
 #define _COROUTINE_DEBUG 1
 
 #include "async.hh"
+#include "async_cache.hh"
+#include "atomic_async.hh"
+#include "concurrent.hh"
+#include "offload.hh"
+#include "profiler.hh"
+#include "shard.hh"
+#include "stream.hh"
 
+#include <format>
 #include <kaffeeklatsch.hh>
+#include <sstream>
+#include <thread>
 using namespace kaffeeklatsch;
 
 using namespace std;
@@ -11,12 +21,12 @@ using namespace cppasync;
 namespace cppasync {
 
 #ifdef _COROUTINE_DEBUG
-unsigned promise_sn_counter = 0;
-unsigned async_sn_counter = 0;
-unsigned awaitable_sn_counter = 0;
-unsigned promise_use_counter = 0;
-unsigned async_use_counter = 0;
-unsigned awaitable_use_counter = 0;
+std::atomic<unsigned> promise_sn_counter = 0;
+std::atomic<unsigned> async_sn_counter = 0;
+std::atomic<unsigned> awaitable_sn_counter = 0;
+std::atomic<unsigned> promise_use_counter = 0;
+std::atomic<unsigned> async_use_counter = 0;
+std::atomic<unsigned> awaitable_use_counter = 0;
 #endif
 
 }  // namespace cppasync
@@ -125,6 +135,298 @@ async<unsigned &> wait_unsigned_ref(unsigned id) {
     global_value = co_await my_interlock.suspend(id);
     co_return global_value_ref;
 }
+async<unsigned &> wait_unsigned_ref_throw(unsigned id) {
+    co_await my_interlock.suspend(id);
+    throw runtime_error("yikes");
+}
+
+async<unsigned> map_and_then_or_else(unsigned id) {
+    auto a = co_await wait_unsigned(id).map([](unsigned v) { return v + 1; });
+    log("map got {}", a);
+    auto b = co_await wait_unsigned(id).and_then([](unsigned v) { return wait_unsigned(v); }).map([](unsigned v) { return v * 2; });
+    log("and_then got {}", b);
+    auto c = co_await wait_unsigned_throw(id).or_else([](std::exception_ptr) { return 0u; });
+    log("or_else got {}", c);
+    co_return a + b + c;
+}
+
+async<> and_then_map_finished(unsigned *out) {
+    *out = co_await no_wait_unsigned(10).and_then([](unsigned v) { return no_wait_unsigned(v + 1); }).map([](unsigned v) { return v * 2; });
+}
+
+async<> map_and_then_throw(unsigned id, string *out) {
+    try {
+        co_await wait_unsigned_throw(id).map([](unsigned v) { return v; }).and_then([](unsigned v) { return no_wait_unsigned(v); });
+    } catch (runtime_error &error) {
+        *out = error.what();
+    }
+}
+
+async<> nested_wait() { co_await wait(); }
+
+async<> join_scope(async_scope *scope) {
+    log("join enter");
+    try {
+        co_await scope->join();
+        log("join leave");
+    } catch (runtime_error &error) {
+        log("join caught '{}'", error.what());
+    }
+}
+
+async<unsigned> arena_handler(std::allocator_arg_t, frame_arena &, unsigned id) {
+    auto v = co_await wait_unsigned(id);
+    co_return co_await no_wait_unsigned(v);
+}
+
+struct throwing_awaiter {
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(std::coroutine_handle<>) { throw runtime_error("yikes"); }
+        void await_resume() const noexcept {}
+};
+async<> await_throwing(std::allocator_arg_t, frame_arena &arena) {
+    try {
+        co_await throwing_awaiter{};
+    } catch (runtime_error &error) {
+        log("caught '{}', arena {}, priority {}", error.what(), detail::current_context.arena == &arena, detail::current_context.priority);
+    }
+}
+
+async<> log_resume(interlock<unsigned, unsigned> *queued_interlock, unsigned id) {
+    auto v = co_await queued_interlock->suspend(id);
+    log("resumed {}", v);
+}
+async<> nested_log_resume(interlock<unsigned, unsigned> *queued_interlock, unsigned id) { co_await log_resume(queued_interlock, id); }
+
+// a C API completing through a callback with a user pointer
+void (*c_api_callback)(void *user, unsigned value) = nullptr;
+void *c_api_user = nullptr;
+void c_api_start(void (*callback)(void *user, unsigned value), void *user) {
+    c_api_callback = callback;
+    c_api_user = user;
+}
+void c_api_start_and_complete(void (*callback)(void *user, unsigned value), void *user) { callback(user, 30); }
+
+async<unsigned> wait_c_api(bool complete_immediately) {
+    auto v = co_await on_callback<unsigned>([&](callback_result<unsigned> *result) {
+        if (complete_immediately) {
+            c_api_start_and_complete(&callback_result<unsigned>::complete, result);
+        } else {
+            c_api_start(&callback_result<unsigned>::complete, result);
+        }
+    });
+    co_return v;
+}
+
+unsigned in_flight = 0, max_in_flight = 0;
+async<unsigned> wait_counted(unsigned id) {
+    max_in_flight = max(max_in_flight, ++in_flight);
+    auto v = co_await my_interlock.suspend(id);
+    --in_flight;
+    if (v == 0) {
+        throw runtime_error(format("yikes {}", id));
+    }
+    co_return v;
+}
+
+void resume_all(unsigned value) {
+    while (!my_interlock.empty()) {
+        my_interlock.resume(my_interlock.begin()->first, value);
+    }
+}
+
+async<> await_shared(shared_async<unsigned> shared, unsigned n) {
+    try {
+        const unsigned &value = co_await shared;
+        log("awaiter {} got {}", n, value);
+    } catch (runtime_error &error) {
+        log("awaiter {} caught '{}'", n, error.what());
+    }
+}
+async<> await_empty_shared() {
+    shared_async<unsigned> empty;
+    try {
+        co_await empty;
+    } catch (broken_promise &) {
+        log("broken promise");
+    }
+}
+
+async<unsigned> shard_id() { co_return shard::current()->id(); }
+async<unsigned> shard_throw() {
+    throw runtime_error(format("yikes {}", shard::current()->id()));
+    co_return 0;
+}
+async<> ask_other_shard(shard &self, unsigned shards, atomic<unsigned> *answers) {
+    auto other = (self.id() + 1) % shards;
+    for (unsigned i = 0; i < 100; ++i) {
+        if (co_await submit_to(other, [] { return shard_id(); }) == other && shard::current() == &self) {
+            ++*answers;
+        }
+    }
+}
+async<> ask_throwing_shard(shard &self, atomic<unsigned> *answers) {
+    try {
+        co_await submit_to(1 - self.id(), [] { return shard_throw(); });
+    } catch (runtime_error &error) {
+        if (error.what() == format("yikes {}", 1 - self.id())) {
+            ++*answers;
+        }
+    }
+}
+
+async<unsigned> offload_increment(blocking_pool *pool, unsigned value, bool *on_loop) {
+    auto loop = this_thread::get_id();
+    auto result = co_await offload(*pool, [value] {
+        this_thread::sleep_for(chrono::milliseconds(5));
+        return value + 1;
+    });
+    *on_loop = this_thread::get_id() == loop;
+    co_return result;
+}
+async<> offload_throw(blocking_pool *pool) {
+    co_await offload(*pool, [] { throw runtime_error("yikes"); });
+}
+async<> offload_blocked(blocking_pool *pool, atomic<bool> *release) {
+    co_await offload(*pool, [release] { release->wait(false); });
+}
+
+struct resume_on_thread {
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(std::coroutine_handle<> coro) { thread([coro] { coro.resume(); }).detach(); }
+        void await_resume() const noexcept {}
+};
+atomic_async<unsigned> atomic_on_thread(unsigned value) {
+    co_await resume_on_thread{};
+    if (value == 0) {
+        throw runtime_error("yikes");
+    }
+    co_return value;
+}
+atomic_async<unsigned> await_atomic_on_thread(unsigned n) {
+    unsigned sum = 0;
+    for (unsigned i = 1; i <= n; ++i) {
+        sum += co_await atomic_on_thread(i);
+    }
+    try {
+        co_await atomic_on_thread(0);
+    } catch (runtime_error &) {
+        ++sum;
+    }
+    co_return sum;
+}
+async<> await_empty_atomic() {
+    atomic_async<unsigned> empty;
+    try {
+        co_await empty;
+    } catch (broken_promise &) {
+        log("broken promise");
+    }
+}
+
+#ifdef CPPASYNC_PROFILE
+sampling_profiler *profiler = nullptr;
+async<unsigned> profiled_inner(unsigned id) {
+    auto v = co_await my_interlock.suspend(id);
+    profiler->sample();
+    co_return v;
+}
+async<unsigned> profiled_outer(unsigned id) { co_return co_await profiled_inner(id) + 1; }
+#endif
+
+async<unsigned> ready_or_wait(unsigned id, bool ready) {
+    if (ready) {
+        return make_ready_async(id);
+    }
+    return wait_unsigned(id);
+}
+async<> await_ready_or_wait(unsigned id, bool ready) {
+    try {
+        log("got {}", co_await ready_or_wait(id, ready));
+    } catch (runtime_error &error) {
+        log("caught '{}'", error.what());
+    }
+}
+
+// returns the chunks one by one, waiting for my_interlock.resume(id, ...) before each one when 'suspend' is set
+struct fake_stream {
+        vector<string> chunks;
+        size_t next = 0;
+        bool suspend = false;
+        unsigned id = 0;
+        string written;
+        size_t write_calls = 0;
+        size_t max_write = 1024;
+        bool fail = false;
+
+        async<size_t> read_some(std::span<std::byte> buffer) {
+            if (suspend) {
+                co_await my_interlock.suspend(id);
+            }
+            if (next == chunks.size()) {
+                co_return 0;
+            }
+            auto& chunk = chunks[next];
+            auto n = min(chunk.size(), buffer.size());
+            memcpy(buffer.data(), chunk.data(), n);
+            if (n == chunk.size()) {
+                ++next;
+            } else {
+                chunk.erase(0, n);
+            }
+            co_return n;
+        }
+        async<size_t> write_some(std::span<const iovec> buffers) {
+            if (suspend) {
+                co_await my_interlock.suspend(id);
+            }
+            ++write_calls;
+            if (fail) {
+                throw runtime_error("yikes");
+            }
+            size_t n = 0;
+            for (auto& buffer : buffers) {
+                auto len = min(buffer.iov_len, max_write - n);
+                written.append(static_cast<const char *>(buffer.iov_base), len);
+                n += len;
+            }
+            co_return n;
+        }
+};
+string as_string(std::span<const std::byte> bytes) { return {reinterpret_cast<const char *>(bytes.data()), bytes.size()}; }
+
+async<> read_lines(async_stream_reader<fake_stream> &reader) {
+    try {
+        while (true) {
+            log("line '{}'", as_string(co_await reader.read_until('\n')));
+        }
+    } catch (end_of_stream &) {
+        log("end of stream, {} bytes left", reader.buffered().size());
+    }
+}
+async<> read_frame(async_stream_reader<fake_stream> &reader) {
+    auto header = co_await reader.read_exact(1);
+    auto size = static_cast<size_t>(header[0]) - '0';
+    log("frame '{}'", as_string(co_await reader.read_exact(size)));
+}
+
+slot_interlock<unsigned> my_slot_interlock;
+slot_key last_slot_key;
+async<> await_slot(const char *name) {
+    auto response = my_slot_interlock.suspend();
+    last_slot_key = response.key();
+    log("{} got {}", name, co_await response);
+}
+
+struct fake_clock {
+        using duration = std::chrono::milliseconds;
+        using rep = duration::rep;
+        using period = duration::period;
+        using time_point = std::chrono::time_point<fake_clock>;
+        static constexpr bool is_steady = true;
+        static inline time_point current{};
+        static time_point now() { return current; }
+};
 
 kaffeeklatsch_spec([] {
     beforeEach([] {
@@ -132,9 +434,9 @@ kaffeeklatsch_spec([] {
         resetCounters();
     });
     afterEach([] {
-        expect(cppasync::async_use_counter).to.equal(0);
-        expect(cppasync::promise_use_counter).to.equal(0);
-        expect(cppasync::awaitable_use_counter).to.equal(0);
+        expect(cppasync::async_use_counter.load()).to.equal(0);
+        expect(cppasync::promise_use_counter.load()).to.equal(0);
+        expect(cppasync::awaitable_use_counter.load()).to.equal(0);
     });
     describe("coroutine", [] {
 
@@ -156,7 +458,7 @@ kaffeeklatsch_spec([] {
             // WHEN we resume the coroutine and provide a return value of 2001
             my_interlock.resume(10, 2001);
 
-            // THEN the coroutine got the value of 2001 and resumed it's execution
+            // THEN the coroutine got the value of 2001 and resumed its execution
             expect(logger).to.equal(vector<string>{
                 "waitOnMyInterlock10IfTrue enter",
                 "waitOnMyInterlock10IfTrue co_await",
@@ -247,7 +549,7 @@ kaffeeklatsch_spec([] {
                 auto async = wait();
                 async.no_wait();
             }
-            expect(cppasync::promise_use_counter).to.equal(1);
+            expect(cppasync::promise_use_counter.load()).to.equal(1);
             cppasync::promise_use_counter = 0;
         });
     });
@@ -305,6 +607,591 @@ kaffeeklatsch_spec([] {
             xit("T&", [] {});
         });
     });
+    describe("map(), and_then() and or_else()", [] {
+        it("transform the result of a suspended async", [] {
+            unsigned out = 0;
+            { map_and_then_or_else(10).then([&](unsigned response) { out = response; }); }
+            my_interlock.resume(10, 20);
+            my_interlock.resume(10, 30);
+            my_interlock.resume(30, 40);
+            my_interlock.resume(10, 50);
+            expect(logger).to.equal(vector<string>{"map got 21", "and_then got 80", "or_else got 0"});
+            expect(out).to.equal(101);
+        });
+        it("transform the result of a finished async", [] {
+            unsigned out = 0;
+            { and_then_map_finished(&out).no_wait(); }
+            expect(out).to.equal(22);
+        });
+        it("pass exceptions through map() and and_then()", [] {
+            string out;
+            { map_and_then_throw(10, &out).no_wait(); }
+            my_interlock.resume(10, 20);
+            expect(out).to.equal("yikes 20");
+        });
+    });
+    describe("sync_wait(...) and run_until_complete(...)", [] {
+        it("sync_wait returns the value of a finished async", [] {
+            expect(sync_wait(no_wait_unsigned(10))).to.equal(10);
+        });
+        it("sync_wait rethrows the exception of a finished async", [] {
+            expect([] { sync_wait(no_wait_unsigned_throw(10)); }).to.throw_(runtime_error("yikes 10"));
+        });
+        it("sync_wait blocks until another thread resumed the async", [] {
+            // the other thread finishes the async before, while or after sync_wait() sets its completion
+            for (unsigned i = 0; i < 100; ++i) {
+                auto async = wait_unsigned(10);
+                thread other([] { my_interlock.resume(10, 20); });
+                auto value = sync_wait(std::move(async));
+                other.join();
+                expect(value).to.equal(20);
+            }
+        });
+        it("run_until_complete executes the queue until the async is finished", [] {
+            run_queue queue;
+            thread other([&] {
+                queue.post([] { my_interlock.resume(10, 20); });
+                queue.post([] { my_interlock.resume(20, 30); });
+            });
+            auto value = run_until_complete(queue, wait_unsigned(10).and_then([](unsigned v) { return wait_unsigned(v); }));
+            other.join();
+            expect(value).to.equal(30);
+        });
+    });
+    describe("async_scope", [] {
+        it("owns the spawned coroutines until they are finished", [] {
+            async_scope scope;
+            scope.spawn(wait_unsigned(10));
+            scope.spawn(wait_void(20));
+            scope.spawn(no_wait_unsigned(30));
+            expect(scope.size()).to.equal(2);
+            my_interlock.resume(20, 0);
+            expect(scope.size()).to.equal(1);
+            my_interlock.resume(10, 0);
+            expect(scope.empty()).to.beTrue();
+            expect(cppasync::promise_use_counter.load()).to.equal(0);
+        });
+        it("join() resumes after the last child is finished", [] {
+            async_scope scope;
+            scope.spawn(wait_unsigned(10));
+            scope.spawn(wait_void(20));
+            { join_scope(&scope).no_wait(); }
+            my_interlock.resume(10, 0);
+            log("resume");
+            my_interlock.resume(20, 0);
+            expect(logger).to.equal(vector<string>{"join enter", "resume", "join leave"});
+        });
+        it("join() rethrows the first exception of the children", [] {
+            async_scope scope;
+            scope.spawn(wait_unsigned_throw(10));
+            scope.spawn(no_wait_void_throw());
+            { join_scope(&scope).no_wait(); }
+            my_interlock.resume(10, 20);
+            expect(logger).to.equal(vector<string>{"join enter", "join caught 'yikes'"});
+        });
+        it("join() rethrows the exception of an async<T&> child", [] {
+            async_scope scope;
+            scope.spawn(wait_unsigned_ref_throw(10));
+            { join_scope(&scope).no_wait(); }
+            my_interlock.resume(10, 20);
+            expect(logger).to.equal(vector<string>{"join enter", "join caught 'yikes'"});
+        });
+        it("destroying the scope destroys the unfinished children", [] {
+            {
+                async_scope scope;
+                scope.spawn(wait());
+                scope.spawn(nested_wait());
+                scope.spawn(wait_unsigned(10));
+                expect(scope.size()).to.equal(3);
+            }
+            expect(cppasync::promise_use_counter.load()).to.equal(0);
+            // the destroyed child is no longer suspended on the interlock
+            expect(my_interlock.empty()).to.beTrue();
+            expect([] { my_interlock.resume(10, 20); }).to.throw_(broken_resume("interlock::resume(...): did not find key"));
+        });
+    });
+    describe("frame_arena", [] {
+        it("allocates the frames of coroutines called with std::allocator_arg and of their children", [] {
+            frame_arena arena;
+            unsigned out = 0;
+            { arena_handler(std::allocator_arg, arena, 10).then([&](unsigned response) { out = response; }); }
+            auto allocated = arena.allocated();
+            expect(allocated > 0).to.beTrue();
+            my_interlock.resume(10, 20);
+            expect(out).to.equal(20);
+            expect(arena.allocated() > allocated).to.beTrue();
+        });
+        it("allocates the frames of coroutines called within an arena_scope", [] {
+            frame_arena arena;
+            {
+                arena_scope use(arena);
+                expect(sync_wait(no_wait_unsigned(10))).to.equal(10);
+            }
+            auto allocated = arena.allocated();
+            expect(allocated > 0).to.beTrue();
+            expect(sync_wait(no_wait_unsigned(10))).to.equal(10);
+            expect(arena.allocated()).to.equal(allocated);
+        });
+    });
+    describe("priorities", [] {
+        it("run_queue runs functions with a higher priority first", [] {
+            run_queue queue;
+            queue.post([] { log("0"); });
+            queue.post([] { log("1"); }, 1);
+            queue.post([] { log("-1"); }, -1);
+            queue.post([] { log("1"); }, 1);
+            while (queue.run_one()) {
+            }
+            expect(logger).to.equal(vector<string>{"1", "1", "0", "-1"});
+        });
+        it("run_queue runs starving functions first", [] {
+            run_queue queue(2);
+            queue.post([] { log("low"); }, -1);
+            for (unsigned i = 0; i < 4; ++i) {
+                queue.post([i] { log("high {}", i); }, 1);
+            }
+            while (queue.run_one()) {
+            }
+            expect(logger).to.equal(vector<string>{"high 0", "high 1", "high 2", "low", "high 3"});
+        });
+        it("interlock resumes coroutines through the run_queue according to their inherited priority", [] {
+            run_queue queue;
+            interlock<unsigned, unsigned> queued_interlock(&queue);
+            { nested_log_resume(&queued_interlock, 10).no_wait(); }
+            {
+                priority_scope interactive(1);
+                nested_log_resume(&queued_interlock, 20).no_wait();
+            }
+            queued_interlock.resume(10, 10);
+            queued_interlock.resume(20, 20);
+            expect(logger.empty()).to.beTrue();
+            while (queue.run_one()) {
+            }
+            expect(logger).to.equal(vector<string>{"resumed 20", "resumed 10"});
+        });
+        it("keeps the context of the coroutine when await_suspend() throws", [] {
+            frame_arena arena;
+            {
+                priority_scope interactive(1);
+                await_throwing(std::allocator_arg, arena).no_wait();
+            }
+            expect(logger).to.equal(vector<string>{"caught 'yikes', arena true, priority 1"});
+            expect(detail::current_context.arena == nullptr).to.beTrue();
+            expect(detail::current_context.priority).to.equal(0);
+        });
+    });
+    describe("on_callback<T>(...)", [] {
+        it("resumes the coroutine from the callback", [] {
+            unsigned out = 0;
+            { wait_c_api(false).then([&](unsigned response) { out = response; }); }
+            expect(out).to.equal(0);
+            c_api_callback(c_api_user, 20);
+            expect(out).to.equal(20);
+        });
+        it("doesn't suspend when the callback is invoked immediately", [] {
+            unsigned out = 0;
+            { wait_c_api(true).then([&](unsigned response) { out = response; }); }
+            expect(out).to.equal(30);
+        });
+    });
+    describe("for_each_concurrent(...) and transform_concurrent(...)", [] {
+        beforeEach([] { in_flight = max_in_flight = 0; });
+        it("for_each_concurrent runs at most n items at a time", [] {
+            bool done = false;
+            vector<unsigned> items{1, 2, 3, 4, 5, 6, 7, 8, 9, 10};
+            { for_each_concurrent(items, 3, [](unsigned id) { return wait_counted(id); }).then([&] { done = true; }); }
+            resume_all(1);
+            expect(done).to.beTrue();
+            expect(max_in_flight).to.equal(3);
+        });
+        it("for_each_concurrent accepts an unbounded n", [] {
+            bool done = false;
+            vector<unsigned> items{1, 2, 3};
+            { for_each_concurrent(items, SIZE_MAX, [](unsigned id) { return wait_counted(id); }).then([&] { done = true; }); }
+            resume_all(1);
+            expect(done).to.beTrue();
+            expect(max_in_flight).to.equal(3);
+        });
+        it("transform_concurrent returns the results in the order of the items", [] {
+            vector<unsigned> out;
+            {
+                transform_concurrent(views::iota(1u, 6u), 2, [](unsigned id) { return wait_counted(id); }).then([&](vector<unsigned> response) {
+                    out = response;
+                });
+            }
+            while (!my_interlock.empty()) {
+                auto id = prev(my_interlock.end())->first;
+                my_interlock.resume(id, id * 10);
+            }
+            expect(out).to.equal(vector<unsigned>{10, 20, 30, 40, 50});
+            expect(max_in_flight).to.equal(2);
+        });
+        it("for_each_concurrent stops starting items after the first exception", [] {
+            string out;
+            vector<unsigned> items{1, 2, 3, 4, 5, 6, 7, 8, 9, 10};
+            {
+                for_each_concurrent(items, 2, [](unsigned id) { return wait_counted(id); })
+                    .thenOrCatch([] {},
+                                 [&](std::exception_ptr eptr) {
+                                     try {
+                                         std::rethrow_exception(eptr);
+                                     } catch (runtime_error &error) {
+                                         out = error.what();
+                                     }
+                                 });
+            }
+            resume_all(0);
+            expect(out).to.equal("yikes 1");
+            expect(max_in_flight).to.equal(2);
+        });
+        it("transform_concurrent continues after fn(item) threw without stop_on_error", [] {
+            string caught;
+            auto fn = [](unsigned id) {
+                if (id == 2) {
+                    throw runtime_error("yikes 2");
+                }
+                return wait_counted(id);
+            };
+            {
+                transform_concurrent(views::iota(1u, 5u), 2, fn, false)
+                    .thenOrCatch([](vector<unsigned>) {},
+                                 [&](std::exception_ptr eptr) {
+                                     try {
+                                         std::rethrow_exception(eptr);
+                                     } catch (runtime_error &error) {
+                                         caught = error.what();
+                                     }
+                                 });
+            }
+            while (!my_interlock.empty()) {
+                auto id = prev(my_interlock.end())->first;
+                log("resume {}", id);
+                my_interlock.resume(id, id * 10);
+            }
+            expect(logger).to.equal(vector<string>{"resume 3", "resume 4", "resume 1"});
+            expect(caught).to.equal("yikes 2");
+        });
+    });
+    describe("shared_async<T>", [] {
+        it("throws broken_promise when awaited without a source", [] {
+            shared_async<unsigned> empty;
+            expect(empty.done()).to.beTrue();
+            expect(empty.failed()).to.beFalse();
+            await_empty_shared().no_wait();
+            expect(logger).to.equal(vector<string>{"broken promise"});
+        });
+        it("resumes all awaiters with the same result", [] {
+            {
+                shared_async<unsigned> shared(wait_unsigned(10));
+                for (unsigned n = 0; n < 3; ++n) {
+                    await_shared(shared, n).no_wait();
+                }
+            }
+            my_interlock.resume(10, 20);
+            expect(logger).to.equal(vector<string>{"awaiter 0 got 20", "awaiter 1 got 20", "awaiter 2 got 20"});
+        });
+        it("doesn't suspend when already finished", [] {
+            shared_async<unsigned> shared(no_wait_unsigned(10));
+            await_shared(shared, 0).no_wait();
+            await_shared(shared, 1).no_wait();
+            expect(logger).to.equal(vector<string>{"awaiter 0 got 10", "awaiter 1 got 10"});
+        });
+        it("rethrows the exception to all awaiters", [] {
+            {
+                shared_async<unsigned> shared(wait_unsigned_throw(10));
+                await_shared(shared, 0).no_wait();
+                await_shared(shared, 1).no_wait();
+            }
+            my_interlock.resume(10, 20);
+            expect(logger).to.equal(vector<string>{"awaiter 0 caught 'yikes 20'", "awaiter 1 caught 'yikes 20'"});
+        });
+    });
+    describe("async_cache<K, V>", [] {
+        it("runs one loader for concurrent requests of the same key", [] {
+            async_cache<unsigned, unsigned, fake_clock> cache(4, 100ms);
+            unsigned calls = 0;
+            auto loader = [&calls](unsigned id) {
+                ++calls;
+                return wait_unsigned(id);
+            };
+            await_shared(cache.get(10, loader), 0).no_wait();
+            await_shared(cache.get(10, loader), 1).no_wait();
+            my_interlock.resume(10, 20);
+            await_shared(cache.get(10, loader), 2).no_wait();
+            expect(calls).to.equal(1);
+            expect(logger).to.equal(vector<string>{"awaiter 0 got 20", "awaiter 1 got 20", "awaiter 2 got 20"});
+        });
+        it("reloads values after their ttl and exceptions after their negative ttl", [] {
+            async_cache<unsigned, unsigned, fake_clock> cache(4, 100ms, 10ms);
+            bool fail = true;
+            auto loader = [&fail](unsigned id) { return fail ? wait_unsigned_throw(id) : wait_unsigned(id); };
+            await_shared(cache.get(10, loader), 0).no_wait();
+            my_interlock.resume(10, 0);
+            await_shared(cache.get(10, loader), 1).no_wait();
+            fail = false;
+            fake_clock::current += 10ms;
+            await_shared(cache.get(10, loader), 2).no_wait();
+            my_interlock.resume(10, 20);
+            fake_clock::current += 99ms;
+            await_shared(cache.get(10, loader), 3).no_wait();
+            fake_clock::current += 1ms;
+            await_shared(cache.get(10, loader), 4).no_wait();
+            my_interlock.resume(10, 30);
+            expect(logger).to.equal(vector<string>{"awaiter 0 caught 'yikes 0'", "awaiter 1 caught 'yikes 0'", "awaiter 2 got 20",
+                                                   "awaiter 3 got 20", "awaiter 4 got 30"});
+        });
+        it("counts the ttl from the end of the loader", [] {
+            async_cache<unsigned, unsigned, fake_clock> cache(4, 100ms);
+            unsigned calls = 0;
+            auto loader = [&calls](unsigned id) {
+                ++calls;
+                return wait_unsigned(id);
+            };
+            await_shared(cache.get(10, loader), 0).no_wait();
+            fake_clock::current += 150ms;
+            my_interlock.resume(10, 20);
+            fake_clock::current += 99ms;
+            await_shared(cache.get(10, loader), 1).no_wait();
+            expect(calls).to.equal(1);
+            expect(logger).to.equal(vector<string>{"awaiter 0 got 20", "awaiter 1 got 20"});
+        });
+        it("replaces entries when full", [] {
+            async_cache<unsigned, unsigned, fake_clock> cache(2, 100ms);
+            unsigned calls = 0;
+            auto loader = [&calls](unsigned value) {
+                ++calls;
+                return no_wait_unsigned(value);
+            };
+            for (unsigned i = 0; i < 10; ++i) {
+                cache.get(i, loader);
+            }
+            expect(cache.size()).to.equal(2);
+            expect(calls).to.equal(10);
+            cache.get(9, loader);
+            expect(calls).to.equal(10);
+            cache.erase(9);
+            expect(cache.size()).to.equal(1);
+            cache.get(9, loader);
+            expect(calls).to.equal(11);
+        });
+    });
+    describe("shard_runtime", [] {
+        it("runs submit_to() on the target shard and continues on the calling shard", [] {
+            shard_runtime runtime(4, 8, false);
+            atomic<unsigned> answers = 0;
+            runtime.run([&answers](shard &self) { return ask_other_shard(self, 4, &answers); });
+            expect(answers.load()).to.equal(400);
+        });
+        it("rethrows the exception on the calling shard", [] {
+            shard_runtime runtime(2, 8, false);
+            atomic<unsigned> answers = 0;
+            runtime.run([&answers](shard &self) { return ask_throwing_shard(self, &answers); });
+            expect(answers.load()).to.equal(2);
+        });
+    });
+    describe("offload(...)", [] {
+        it("runs the function on the pool and continues on the loop", [] {
+            run_queue queue;
+            blocking_pool pool(queue, 2);
+            bool on_loop = false;
+            expect(run_until_complete(queue, offload_increment(&pool, 10, &on_loop))).to.equal(11);
+            expect(on_loop).to.beTrue();
+            expect(pool.stats().completed).to.equal(1);
+            expect(pool.queue_depth()).to.equal(0);
+        });
+        it("continues on the run_queue the coroutine was running on", [] {
+            run_queue pool_loop, loop;
+            blocking_pool pool(pool_loop, 1);
+            bool on_loop = false;
+            unsigned result = 0;
+            loop.post([&] { offload_increment(&pool, 10, &on_loop).then([&](unsigned v) { result = v; }); });
+            loop.run_until([&] { return result != 0; });
+            expect(result).to.equal(11);
+            expect(on_loop).to.beTrue();
+            expect(pool_loop.run_one()).to.beFalse();
+        });
+        it("rethrows the exception on the loop", [] {
+            run_queue queue;
+            blocking_pool pool(queue, 1);
+            expect([&] { run_until_complete(queue, offload_throw(&pool)); }).to.throw_(runtime_error("yikes"));
+        });
+        it("accepts functions for idle threads without a queue", [] {
+            run_queue queue;
+            blocking_pool pool(queue, 1, 0);
+            bool on_loop = false;
+            expect(run_until_complete(queue, offload_increment(&pool, 10, &on_loop))).to.equal(11);
+            expect(pool.stats().rejected).to.equal(0);
+        });
+        it("throws offload_rejected when the threads are busy and the queue is full", [] {
+            run_queue queue;
+            blocking_pool pool(queue, 1, 1);
+            atomic<bool> release = false;
+            auto running = offload_blocked(&pool, &release);
+            auto queued = offload_blocked(&pool, &release);
+            expect([&] { run_until_complete(queue, offload_throw(&pool)); }).to.throw_(offload_rejected());
+            expect(pool.stats().rejected).to.equal(1);
+            release = true;
+            release.notify_all();
+            run_until_complete(queue, std::move(running));
+            run_until_complete(queue, std::move(queued));
+            expect(pool.stats().completed).to.equal(2);
+        });
+    });
+    describe("atomic_async<T>", [] {
+        it("can be awaited while it's finished on another thread", [] {
+            auto outer = await_atomic_on_thread(100);
+            while (!outer.done()) {
+                this_thread::yield();
+            }
+            expect(outer.result()).to.equal(5051);
+        });
+        it("throws broken_promise when awaiting an empty atomic_async", [] {
+            await_empty_atomic().no_wait();
+            expect(logger).to.equal(vector<string>{"broken promise"});
+        });
+    });
+#ifdef CPPASYNC_PROFILE
+    describe("sampling_profiler", [] {
+        it("samples the running coroutine along with those awaiting it", [] {
+            sampling_profiler sampler;
+            profiler = &sampler;
+            auto outer = profiled_outer(10);
+            my_interlock.resume(10, 20);
+            ostringstream out;
+            sampler.write_folded(out);
+            auto folded = out.str();
+            auto outer_pos = folded.find("profiled_outer");
+            auto inner_pos = folded.find("profiled_inner");
+            expect(outer_pos < inner_pos && inner_pos != string::npos).to.beTrue();
+            expect(folded.ends_with(" 1\n")).to.beTrue();
+        });
+    });
+#endif
+    describe("make_ready_async(...) and make_exceptional_async(...)", [] {
+        it("returns the value without a coroutine frame", [] {
+            await_ready_or_wait(10, true).no_wait();
+            await_ready_or_wait(20, false).no_wait();
+            my_interlock.resume(20, 30);
+            expect(logger).to.equal(vector<string>{"got 10", "got 30"});
+            expect(make_ready_async(10).done()).to.beTrue();
+            expect(cppasync::promise_use_counter.load()).to.equal(0);
+        });
+        it("rethrows the exception", [] {
+            expect([] { sync_wait(make_exceptional_async<unsigned>(runtime_error("yikes"))); }).to.throw_(runtime_error("yikes"));
+            expect([] { sync_wait(make_exceptional_async(runtime_error("yikes"))); }).to.throw_(runtime_error("yikes"));
+        });
+        it("works with then() and map()", [] {
+            unsigned out = 0;
+            make_ready_async(10u).then([&out](unsigned v) { out = v; });
+            expect(out).to.equal(10);
+            expect(sync_wait(make_ready_async(10u).map([](unsigned v) { return v + 1; }))).to.equal(11);
+        });
+        it("keeps the value out of line", [] {
+            struct not_assignable {
+                    string text;
+                    explicit not_assignable(string t) : text(std::move(t)) {}
+                    not_assignable(not_assignable&&) = default;
+                    not_assignable& operator=(not_assignable&&) = delete;
+            };
+            static_assert(sizeof(async<string>) == sizeof(async<>));
+            async<not_assignable> a = make_ready_async(not_assignable("hello"));
+            async<not_assignable> b;
+            b = std::move(a);
+            expect(sync_wait(std::move(b)).text).to.equal("hello");
+            expect([&a] { sync_wait(std::move(a)); }).to.throw_(broken_promise());
+        });
+    });
+    describe("async_stream_reader<S> and async_stream_writer<S>", [] {
+        it("read_until() splits the stream into lines", [] {
+            fake_stream stream{.chunks = {"he", "llo\nwor", "ld\n\nrest"}};
+            async_stream_reader reader(stream, 4);
+            read_lines(reader).no_wait();
+            expect(logger).to.equal(vector<string>{"line 'hello\n'", "line 'world\n'", "line '\n'", "end of stream, 4 bytes left"});
+        });
+        it("read_exact() waits for the stream", [] {
+            fake_stream stream{.chunks = {"5ab", "cde3xyz"}, .suspend = true, .id = 10};
+            async_stream_reader reader(stream, 16);
+            read_frame(reader).no_wait();
+            my_interlock.resume(10, 0);
+            expect(logger).to.equal(vector<string>{});
+            my_interlock.resume(10, 0);
+            expect(logger).to.equal(vector<string>{"frame 'abcde'"});
+            // already buffered
+            read_frame(reader).no_wait();
+            expect(logger).to.equal(vector<string>{"frame 'abcde'", "frame 'xyz'"});
+        });
+        it("throws length_error when a line exceeds the maximal buffer size", [] {
+            fake_stream stream{.chunks = {"aaaaaaaa"}};
+            async_stream_reader reader(stream, 2, 4);
+            expect([&] { sync_wait(reader.read_until('\n')); }).to.throw_(length_error("async_stream_reader: message exceeds the maximal buffer size"));
+        });
+        it("coalesces small writes into a single write_some()", [] {
+            fake_stream stream{.max_write = 3};
+            async_stream_writer writer(stream, 16, 4);
+            string large(10, 'x');
+            sync_wait([&]() -> async<> {
+                co_await writer.write("a");
+                co_await writer.write("bc");
+                co_await writer.write("def");
+                expect(stream.write_calls).to.equal(0);
+                co_await writer.write(large);
+                co_await writer.write("g");
+                co_await writer.flush();
+            }());
+            expect(stream.written).to.equal("abcdef" + large + "g");
+            expect(stream.write_calls).to.equal(7);
+        });
+        it("drops the buffers when write_some() throws", [] {
+            fake_stream stream{.fail = true};
+            async_stream_writer writer(stream, 16, 4);
+            {
+                string large(10, 'x');
+                sync_wait(writer.write("ab"));
+                expect([&] { sync_wait(writer.write(large)); }).to.throw_(runtime_error("yikes"));
+            }
+            expect(writer.buffered()).to.equal(0);
+            stream.fail = false;
+            sync_wait([&]() -> async<> {
+                co_await writer.write("cd");
+                co_await writer.flush();
+            }());
+            expect(stream.written).to.equal("cd");
+        });
+    });
+    describe("slot_interlock<V>", [] {
+        it("resumes the coroutine suspended on the allocated key", [] {
+            await_slot("a").no_wait();
+            auto a = last_slot_key;
+            await_slot("b").no_wait();
+            auto b = last_slot_key;
+            expect(my_slot_interlock.size()).to.equal(2);
+            my_slot_interlock.resume(b, 20);
+            my_slot_interlock.resume(a, 10);
+            expect(logger).to.equal(vector<string>{"b got 20", "a got 10"});
+            expect(my_slot_interlock.empty()).to.beTrue();
+        });
+        it("reuses the last freed slot with a new generation", [] {
+            await_slot("a").no_wait();
+            auto a = last_slot_key;
+            my_slot_interlock.resume(a, 10);
+            await_slot("b").no_wait();
+            auto b = last_slot_key;
+            expect(b.index).to.equal(a.index);
+            expect(b.generation).to.equal(a.generation + 1);
+            expect([&] { my_slot_interlock.resume(a, 20); }).to.throw_(broken_resume("slot_interlock::resume(...): stale key"));
+            my_slot_interlock.resume(slot_key::from_id(b.id()), 30);
+            expect(logger).to.equal(vector<string>{"a got 10", "b got 30"});
+        });
+        it("doesn't suspend when resumed before co_await", [] {
+            auto value = sync_wait([]() -> async<unsigned> {
+                auto response = my_slot_interlock.suspend();
+                my_slot_interlock.resume(response.key(), 10);
+                co_return co_await response;
+            }());
+            expect(value).to.equal(10);
+            expect(my_slot_interlock.empty()).to.beTrue();
+        });
+    });
     describe("thenOrCatch(..., ...)", [] {
         describe("will be executed after the co_await", [] {
             it("T", [] {
@@ -0,0 +1,184 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "async.hh"
+
+CPPASYNC_EXPORT namespace cppasync {
+
+// a cache of the results of coroutines with at most one loader running per key:
+//
+//   V value = co_await cache.get(key, [](const K& key) { return load(key); });
+//
+// a hit returns the cached shared_async without allocating, a miss starts the loader and all requests
+// for the key made until it is finished await the same shared_async. results expire after 'ttl',
+// exceptions after 'negative_ttl' (zero disables caching them), both counted from the end of the
+// loader. when all 'capacity' entries are used, the CLOCK algorithm picks the entry to be replaced,
+// preferring finished ones. the value is owned by the entry, so a reference to it is only valid as
+// long as the shared_async returned by get() is kept.
+//
+// the entries are stored in a vector of fixed size and found by an open addressing hash table of their
+// indices. K must be default constructible.
+template <typename K, typename V, typename CLOCK = std::chrono::steady_clock, typename HASH = std::hash<K>>
+class async_cache {
+    public:
+        using duration = typename CLOCK::duration;
+
+        async_cache(std::size_t capacity, duration ttl, duration negative_ttl = duration::zero())
+            : m_entries(std::max<std::size_t>(capacity, 1)), m_ttl(ttl), m_negative_ttl(negative_ttl) {
+            std::size_t size = 2;
+            while (size < m_entries.size() * 2) {
+                size *= 2;
+            }
+            m_index.resize(size, empty);
+        }
+        async_cache(const async_cache&) = delete;
+        async_cache& operator=(const async_cache&) = delete;
+
+        template <typename LOADER>
+        shared_async<V> get(const K& key, LOADER&& loader) {
+            auto now = CLOCK::now();
+            auto pos = find(key);
+            if (pos != npos) {
+                auto& e = m_entries[m_index[pos]];
+                if (!expired(e, now)) {
+                    e.referenced = true;
+                    return e.value;
+                }
+            }
+            auto loaded = std::make_shared<typename CLOCK::time_point>();
+            shared_async<V> value(stamp(std::invoke(std::forward<LOADER>(loader), key), loaded));
+            // the loader might have used the cache too, so look again
+            pos = find(key);
+            auto& e = m_entries[pos != npos ? m_index[pos] : claim(key)];
+            e.value = value;
+            e.loaded = std::move(loaded);
+            e.referenced = true;
+            return value;
+        }
+        void erase(const K& key) {
+            auto pos = find(key);
+            if (pos != npos) {
+                auto& e = m_entries[m_index[pos]];
+                e.used = false;
+                e.value = {};
+                e.loaded.reset();
+                erase_index(pos);
+                --m_size;
+            }
+        }
+        std::size_t size() const noexcept { return m_size; }
+        std::size_t capacity() const noexcept { return m_entries.size(); }
+
+    private:
+        struct entry {
+                K key{};
+                shared_async<V> value;
+                // set when the loader has finished, shared with stamp() as the entry might be replaced or the
+                // cache destroyed before
+                std::shared_ptr<typename CLOCK::time_point> loaded;
+                bool referenced = false;
+                bool used = false;
+        };
+        static constexpr std::uint32_t empty = ~std::uint32_t(0);
+        static constexpr std::size_t npos = ~std::size_t(0);
+
+        bool expired(const entry& e, typename CLOCK::time_point now) const noexcept {
+            if (!e.value.done()) {
+                return false;
+            }
+            return now - *e.loaded >= (e.value.failed() ? m_negative_ttl : m_ttl);
+        }
+        static async<V> stamp(async<V> load, std::shared_ptr<typename CLOCK::time_point> loaded) {
+            try {
+                auto value = co_await std::move(load);
+                *loaded = CLOCK::now();
+                co_return value;
+            } catch (...) {
+                *loaded = CLOCK::now();
+                throw;
+            }
+        }
+
+        std::size_t home(const K& key) const noexcept { return HASH{}(key) & (m_index.size() - 1); }
+        std::size_t find(const K& key) const noexcept {
+            for (auto pos = home(key);; pos = (pos + 1) & (m_index.size() - 1)) {
+                if (m_index[pos] == empty) {
+                    return npos;
+                }
+                if (m_entries[m_index[pos]].key == key) {
+                    return pos;
+                }
+            }
+        }
+        void insert_index(const K& key, std::uint32_t idx) noexcept {
+            auto pos = home(key);
+            while (m_index[pos] != empty) {
+                pos = (pos + 1) & (m_index.size() - 1);
+            }
+            m_index[pos] = idx;
+        }
+        // backward shift deletion, keeps the probe sequences intact without tombstones
+        void erase_index(std::size_t pos) noexcept {
+            auto mask = m_index.size() - 1;
+            m_index[pos] = empty;
+            for (auto next = (pos + 1) & mask; m_index[next] != empty; next = (next + 1) & mask) {
+                auto h = home(m_entries[m_index[next]].key);
+                // move the entry into the hole unless its home lies cyclically within (pos, next]
+                bool stays = pos <= next ? (pos < h && h <= next) : (pos < h || h <= next);
+                if (!stays) {
+                    m_index[pos] = m_index[next];
+                    m_index[next] = empty;
+                    pos = next;
+                }
+            }
+        }
+
+        // the index of an entry for the key, replacing another one if needed
+        std::uint32_t claim(const K& key) {
+            auto idx = victim();
+            auto& e = m_entries[idx];
+            if (e.used) {
+                erase_index(find(e.key));
+            } else {
+                ++m_size;
+            }
+            e.key = key;
+            e.used = true;
+            insert_index(key, idx);
+            return idx;
+        }
+        std::uint32_t victim() noexcept {
+            // entries with running loaders are only replaced when all entries have running loaders
+            std::size_t running = 0;
+            while (true) {
+                auto idx = static_cast<std::uint32_t>(m_hand);
+                auto& e = m_entries[idx];
+                m_hand = (m_hand + 1) % m_entries.size();
+                if (!e.used) {
+                    return idx;
+                }
+                if (e.referenced) {
+                    e.referenced = false;
+                    continue;
+                }
+                if (!e.value.done() && ++running < m_entries.size()) {
+                    continue;
+                }
+                return idx;
+            }
+        }
+
+        std::vector<entry> m_entries;
+        std::vector<std::uint32_t> m_index;
+        std::size_t m_size = 0;
+        std::size_t m_hand = 0;
+        duration m_ttl;
+        duration m_negative_ttl;
+};
+
+}  // namespace cppasync
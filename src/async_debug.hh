@@ -0,0 +1,31 @@
+#pragma once
+
+#include <atomic>
+#include <coroutine>
+
+// the counters used by the _COROUTINE_DEBUG build, to be defined by the application. they are atomic as coroutines
+// might be created and destroyed on several threads, e.g. by shard_runtime.
+
+#ifndef CPPASYNC_EXPORT
+#define CPPASYNC_EXPORT
+#endif
+
+CPPASYNC_EXPORT namespace cppasync {
+
+// attached to the global module when declared by the cppasync:debug partition, so that they link against the
+// definitions of the application
+extern "C++" {
+extern std::atomic<unsigned> promise_sn_counter;
+extern std::atomic<unsigned> async_sn_counter;
+extern std::atomic<unsigned> awaitable_sn_counter;
+extern std::atomic<unsigned> promise_use_counter;
+extern std::atomic<unsigned> async_use_counter;
+extern std::atomic<unsigned> awaitable_use_counter;
+extern std::coroutine_handle<> global_continuation;
+unsigned getSNforHandle(std::coroutine_handle<> handle);
+inline void resetCounters() {
+    promise_sn_counter = async_sn_counter = awaitable_sn_counter = promise_use_counter = async_use_counter = awaitable_use_counter = 0;
+}
+}  // extern "C++"
+
+}  // namespace cppasync
@@ -0,0 +1,156 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+#include "async.hh"
+
+CPPASYNC_EXPORT namespace cppasync {
+
+template <typename T>
+class atomic_async;
+
+namespace detail {
+
+// async_promise with a state word, which is either nullptr while the coroutine is running, the awaiting
+// coroutine's address, 'finished' or 'detached'. it's changed by one compare-and-swap when suspending the
+// awaiting coroutine and one exchange in final_suspend(), so that awaiting and finishing can happen on
+// different threads.
+template <typename T>
+class atomic_promise : public async_promise<T> {
+    public:
+        static inline void* const finished = reinterpret_cast<void*>(std::uintptr_t(1));
+        static inline void* const detached = reinterpret_cast<void*>(std::uintptr_t(2));
+
+        atomic_async<T> get_return_object(std::source_location where = std::source_location::current()) noexcept;
+
+        struct final_awaitable {
+                bool await_ready() const noexcept { return false; }
+                std::coroutine_handle<> await_suspend(std::coroutine_handle<atomic_promise> coro) noexcept {
+                    coro.promise().set_awaiting(std::coroutine_handle<>{});
+                    auto state = coro.promise().m_state.exchange(finished, std::memory_order_acq_rel);
+                    if (state == detached) {
+                        coro.destroy();
+                        return std::noop_coroutine();
+                    }
+                    if (state) {
+                        return std::coroutine_handle<>::from_address(state);
+                    }
+                    return std::noop_coroutine();
+                }
+                void await_resume() const noexcept {}
+        };
+        final_awaitable final_suspend() noexcept {
+            this->leave_context();
+            return {};
+        }
+
+        bool done() const noexcept { return m_state.load(std::memory_order_acquire) == finished; }
+        // returns false when the coroutine has already finished
+        template <typename PROMISE>
+        bool suspend(std::coroutine_handle<PROMISE> parent) noexcept {
+            this->set_awaiting(parent);
+            void* expected = nullptr;
+            return m_state.compare_exchange_strong(expected, parent.address(), std::memory_order_release, std::memory_order_acquire);
+        }
+        // returns false when the coroutine has already finished
+        bool detach() noexcept {
+            void* expected = nullptr;
+            return m_state.compare_exchange_strong(expected, detached, std::memory_order_release, std::memory_order_acquire);
+        }
+
+    private:
+        std::atomic<void*> m_state = nullptr;
+};
+
+}  // namespace detail
+
+// like async<T> but can be awaited while it's being finished on another thread, e.g. after having been
+// resumed by a thread pool. awaiting costs an atomic compare-and-swap and an atomic exchange, while the
+// resume path of async<T> uses no atomic read-modify-write.
+template <typename T = void>
+class [[nodiscard]] atomic_async {
+    public:
+        using promise_type = detail::atomic_promise<T>;
+        using handle_type = std::coroutine_handle<promise_type>;
+        using value_type = T;
+
+        atomic_async() noexcept = default;
+        explicit atomic_async(handle_type coroutine) noexcept : m_coroutine(coroutine) {}
+        atomic_async(atomic_async&& other) noexcept : m_coroutine(std::exchange(other.m_coroutine, nullptr)) {}
+        atomic_async& operator=(atomic_async&& other) noexcept {
+            if (std::addressof(other) != this) {
+                if (m_coroutine) {
+                    m_coroutine.destroy();
+                }
+                m_coroutine = std::exchange(other.m_coroutine, nullptr);
+            }
+            return *this;
+        }
+        atomic_async(const atomic_async&) = delete;
+        atomic_async& operator=(const atomic_async&) = delete;
+        ~atomic_async() noexcept(false) {
+            if (m_coroutine) {
+                bool finished = m_coroutine.promise().done();
+                m_coroutine.destroy();
+                if (!finished && !detail::destroying_scope) {
+                    throw unfinished_promise();
+                }
+            }
+        }
+
+    private:
+        template <bool MOVE>
+        struct awaitable {
+                handle_type m_coroutine;
+                bool await_ready() const noexcept { return !m_coroutine || m_coroutine.promise().done(); }
+                template <typename PROMISE>
+                bool await_suspend(std::coroutine_handle<PROMISE> parent) noexcept {
+                    return m_coroutine.promise().suspend(parent);
+                }
+                decltype(auto) await_resume() {
+                    if (!m_coroutine) {
+                        throw broken_promise{};
+                    }
+                    if constexpr (MOVE) {
+                        return std::move(m_coroutine.promise()).result();
+                    } else {
+                        return m_coroutine.promise().result();
+                    }
+                }
+        };
+
+    public:
+        auto operator co_await() const& noexcept { return awaitable<false>{m_coroutine}; }
+        auto operator co_await() const&& noexcept { return awaitable<true>{m_coroutine}; }
+
+        // the coroutine destroys itself when finished
+        void no_wait() {
+            if (m_coroutine && m_coroutine.promise().detach()) {
+                m_coroutine = nullptr;
+            }
+        }
+        bool done() const noexcept { return !m_coroutine || m_coroutine.promise().done(); }
+        // must only be called after done() returned true
+        decltype(auto) result() {
+            if (!m_coroutine) {
+                throw broken_promise{};
+            }
+            return std::move(m_coroutine.promise()).result();
+        }
+
+    private:
+        handle_type m_coroutine;
+};
+
+namespace detail {
+
+template <typename T>
+atomic_async<T> atomic_promise<T>::get_return_object(const std::source_location where) noexcept {
+    this->set_function(where);
+    return atomic_async<T>{std::coroutine_handle<atomic_promise>::from_promise(*this)};
+}
+
+}  // namespace detail
+
+}  // namespace cppasync
@@ -0,0 +1,32 @@
+#!/bin/bash
+# compile-bench.sh <compiler> <flags> [<number of translation units>]
+#
+# compiles the same translation units once with '#include "async.hh"' and once with 'import cppasync;'
+# and prints the time taken for each. expects cppasync.pcm to be built already (make compile-bench).
+
+CXX=${1:-clang++}
+CFLAGS=${2:--std=c++23}
+N=${3:-50}
+SRC=$(cd "$(dirname "$0")" && pwd)
+DIR=$(mktemp -d)
+trap 'rm -rf "$DIR"' EXIT
+
+for ((i = 0; i < N; ++i)); do
+    BODY="
+using namespace cppasync;
+interlock<unsigned, unsigned> replies$i;
+async<unsigned> request$i(unsigned id) {
+    auto reply = co_await replies$i.suspend(id);
+    co_return reply;
+}
+async<> handle$i() { co_await request$i($i).map([](unsigned reply) { return reply + 1; }); }
+"
+    printf '#include "%s/async.hh"\n%s' "$SRC" "$BODY" > "$DIR/include$i.cc"
+    printf 'import cppasync;\n%s' "$BODY" > "$DIR/import$i.cc"
+done
+
+TIMEFORMAT="%R seconds"
+echo "$N translation units with #include \"async.hh\":"
+time (for ((i = 0; i < N; ++i)); do $CXX $CFLAGS -c -o /dev/null "$DIR/include$i.cc" || exit 1; done)
+echo "$N translation units with import cppasync:"
+time (for ((i = 0; i < N; ++i)); do $CXX $CFLAGS -fprebuilt-module-path="$SRC" -c -o /dev/null "$DIR/import$i.cc" || exit 1; done)
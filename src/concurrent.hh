@@ -0,0 +1,150 @@
+#pragma once
+
+#include <deque>
+#include <ranges>
+#include <vector>
+
+#include "async.hh"
+
+CPPASYNC_EXPORT namespace cppasync {
+
+namespace detail {
+
+// runs fn(item) for the items in [it, end) with at most n of the returned asyncs unfinished at a time.
+// each of the n slots starts the next item from the final_suspend() of its finished one.
+template <typename ITERATOR, typename SENTINEL, typename FN, typename RESULTS>
+class concurrent_runner {
+        using async_type = std::invoke_result_t<FN&, std::iter_reference_t<ITERATOR>>;
+
+        struct slot : completion {
+                concurrent_runner* runner;
+                std::optional<async_type> current;
+                std::size_t index;
+                std::coroutine_handle<> complete() noexcept override {
+                    runner->finished(*this);
+                    if (runner->run(*this)) {
+                        return std::noop_coroutine();
+                    }
+                    if (--runner->m_active == 0 && runner->m_parent) {
+                        return runner->m_parent;
+                    }
+                    return std::noop_coroutine();
+                }
+        };
+
+    public:
+        concurrent_runner(ITERATOR it, SENTINEL end, std::size_t n, FN& fn, bool stop_on_error, RESULTS* results)
+            : m_it(std::move(it)), m_end(std::move(end)), m_fn(fn), m_stop_on_error(stop_on_error), m_results(results) {
+            // the slots are created as long as there are items left, so that a large n doesn't allocate
+            for (std::size_t i = 0; i < n && !m_stopped && m_it != m_end; ++i) {
+                auto& s = m_slots.emplace_back();
+                s.runner = this;
+                if (run(s)) {
+                    ++m_active;
+                }
+            }
+        }
+        concurrent_runner(const concurrent_runner&) = delete;
+        concurrent_runner& operator=(const concurrent_runner&) = delete;
+
+        // co_await runner waits for all items to finish and rethrows the first exception
+        bool await_ready() const noexcept { return m_active == 0; }
+        void await_suspend(std::coroutine_handle<> parent) noexcept { m_parent = parent; }
+        void await_resume() {
+            if (m_exception) {
+                std::rethrow_exception(m_exception);
+            }
+        }
+
+    private:
+        // start items on the slot until one suspends (returns true) or there are none left
+        bool run(slot& s) noexcept {
+            while (!m_stopped && m_it != m_end) {
+                s.index = m_index++;
+                try {
+                    s.current.emplace(std::invoke(m_fn, *m_it));
+                } catch (...) {
+                    failed(std::current_exception());
+                }
+                ++m_it;
+                if (!s.current) {
+                    continue;
+                }
+                if (s.current->on_complete(&s)) {
+                    return true;
+                }
+                finished(s);
+            }
+            return false;
+        }
+        void finished(slot& s) noexcept {
+            try {
+                if constexpr (std::is_void_v<RESULTS>) {
+                    s.current->result();
+                } else {
+                    (*m_results)[s.index] = s.current->result();
+                }
+            } catch (...) {
+                failed(std::current_exception());
+            }
+            s.current.reset();
+        }
+        void failed(std::exception_ptr eptr) noexcept {
+            if (!m_exception) {
+                m_exception = eptr;
+            }
+            if (m_stop_on_error) {
+                m_stopped = true;
+            }
+        }
+
+        ITERATOR m_it;
+        SENTINEL m_end;
+        FN& m_fn;
+        bool m_stop_on_error;
+        bool m_stopped = false;
+        RESULTS* m_results;
+        std::deque<slot> m_slots;  // stable addresses for the completions
+        std::size_t m_index = 0;
+        std::size_t m_active = 0;
+        std::coroutine_handle<> m_parent;
+        std::exception_ptr m_exception;
+};
+
+template <typename VIEW, typename FN>
+async<> for_each_concurrent(VIEW view, std::size_t n, FN fn, bool stop_on_error) {
+    auto begin = std::ranges::begin(view);
+    auto end = std::ranges::end(view);
+    co_await concurrent_runner<decltype(begin), decltype(end), FN, void>(begin, end, n, fn, stop_on_error, nullptr);
+}
+
+template <typename VIEW, typename FN, typename RESULT>
+async<std::vector<RESULT>> transform_concurrent(VIEW view, std::size_t n, FN fn, bool stop_on_error) {
+    std::vector<RESULT> results(std::ranges::size(view));
+    auto begin = std::ranges::begin(view);
+    auto end = std::ranges::end(view);
+    co_await concurrent_runner<decltype(begin), decltype(end), FN, std::vector<RESULT>>(begin, end, n, fn, stop_on_error, &results);
+    co_return std::move(results);
+}
+
+}  // namespace detail
+
+// co_await fn(item) for all items of the range with at most n of them at a time, rethrows the first
+// exception after all started items are finished. with stop_on_error no more items are started after
+// an exception.
+template <std::ranges::viewable_range RANGE, typename FN>
+async<> for_each_concurrent(RANGE&& range, std::size_t n, FN fn, bool stop_on_error = true) {
+    return detail::for_each_concurrent(std::views::all(std::forward<RANGE>(range)), std::max<std::size_t>(n, 1), std::move(fn), stop_on_error);
+}
+
+// like for_each_concurrent() but returns the results of fn(item) in the order of the items.
+// the result type must be default constructible.
+template <std::ranges::viewable_range RANGE, typename FN>
+    requires std::ranges::sized_range<RANGE>
+auto transform_concurrent(RANGE&& range, std::size_t n, FN fn, bool stop_on_error = true) {
+    using result_type = typename std::invoke_result_t<FN&, std::ranges::range_reference_t<RANGE>>::value_type;
+    return detail::transform_concurrent<std::views::all_t<RANGE>, FN, result_type>(std::views::all(std::forward<RANGE>(range)), std::max<std::size_t>(n, 1),
+                                                                                   std::move(fn), stop_on_error);
+}
+
+}  // namespace cppasync
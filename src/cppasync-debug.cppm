@@ -0,0 +1,13 @@
+// the counters used by the _COROUTINE_DEBUG build, empty otherwise
+
+module;
+
+#include <atomic>
+#include <coroutine>
+
+export module cppasync:debug;
+
+#ifdef _COROUTINE_DEBUG
+#define CPPASYNC_EXPORT export
+#include "async_debug.hh"
+#endif
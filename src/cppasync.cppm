@@ -0,0 +1,64 @@
+// module interface for async.hh, async_cache.hh, atomic_async.hh, concurrent.hh, offload.hh, profiler.hh, shard.hh and stream.hh
+//
+// import cppasync;
+//
+// the _COROUTINE_DEBUG and CPPASYNC_PROFILE builds of the module must be used with builds of the application
+// defining the same.
+
+module;
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <condition_variable>
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <optional>
+#include <ostream>
+#ifdef _COROUTINE_DEBUG
+#include <print>
+#endif
+#include <ranges>
+#include <source_location>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#ifdef __linux__
+#include <pthread.h>
+#endif
+#include <signal.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+
+export module cppasync;
+
+export import :debug;
+
+#define CPPASYNC_MODULE
+#define CPPASYNC_EXPORT export
+
+#include "async.hh"
+#include "async_cache.hh"
+#include "atomic_async.hh"
+#include "concurrent.hh"
+#include "offload.hh"
+#include "profiler.hh"
+#include "shard.hh"
+#include "stream.hh"
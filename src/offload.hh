@@ -0,0 +1,218 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "async.hh"
+
+CPPASYNC_EXPORT namespace cppasync {
+
+class offload_rejected : public std::runtime_error {
+    public:
+        offload_rejected() : std::runtime_error("offload rejected") {}
+        explicit offload_rejected(const std::string& what) : runtime_error(what) {}
+        explicit offload_rejected(const char* what) : runtime_error(what) {}
+};
+
+namespace detail {
+
+// a function waiting for or running on a thread of a blocking_pool. it's the awaiter of offload()
+// and lives in the frame of the offloading coroutine.
+class offload_job {
+    public:
+        // run the function on the pool's thread
+        virtual void run() noexcept = 0;
+        // continue the coroutine on its loop
+        virtual void resume() noexcept = 0;
+        std::chrono::steady_clock::time_point queued;
+
+    protected:
+        ~offload_job() = default;
+};
+
+}  // namespace detail
+
+// a fixed number of threads for blocking calls, e.g. to name resolution, compression or synchronous clients,
+// which would otherwise stall the loop. the offloading coroutines continue on the run_queue they were running
+// on, see run_queue::current(), or on 'loop' when they weren't run by a queue, e.g. before the first
+// suspension of a coroutine called from synchronous code. when all threads are busy and 'max_queued'
+// functions are waiting for one, offload() throws offload_rejected.
+class blocking_pool {
+    public:
+        struct statistics {
+                std::size_t queued;     // functions waiting for a thread
+                std::size_t running;    // functions being run
+                std::uint64_t completed;
+                std::uint64_t rejected;
+                std::chrono::nanoseconds total_wait;  // summed up time between offload() and start of the function
+                std::chrono::nanoseconds max_wait;
+        };
+
+        explicit blocking_pool(run_queue& loop, unsigned threads = 4, std::size_t max_queued = 1024) : m_loop(loop), m_max_queued(max_queued) {
+            for (unsigned i = 0; i < std::max(threads, 1u); ++i) {
+                m_threads.emplace_back([this] { work(); });
+            }
+        }
+        blocking_pool(const blocking_pool&) = delete;
+        blocking_pool& operator=(const blocking_pool&) = delete;
+        // runs the queued functions before returning
+        ~blocking_pool() {
+            {
+                std::lock_guard lock(m_mutex);
+                m_stopping = true;
+            }
+            m_cv.notify_all();
+            for (auto& thread : m_threads) {
+                thread.join();
+            }
+        }
+
+        run_queue& loop() const noexcept { return m_loop; }
+        std::size_t queue_depth() const {
+            std::lock_guard lock(m_mutex);
+            return m_queue.size();
+        }
+        statistics stats() const {
+            std::lock_guard lock(m_mutex);
+            return {m_queue.size(), m_running, m_completed, m_rejected, m_total_wait, m_max_wait};
+        }
+
+        // returns false when the queue is full
+        bool submit(detail::offload_job* job) {
+            {
+                std::lock_guard lock(m_mutex);
+                // queued functions are taken by the idle threads first
+                auto idle = m_threads.size() - m_running;
+                if (m_queue.size() >= m_max_queued + idle) {
+                    ++m_rejected;
+                    return false;
+                }
+                job->queued = std::chrono::steady_clock::now();
+                m_queue.push_back(job);
+            }
+            m_cv.notify_one();
+            return true;
+        }
+
+    private:
+        void work() {
+            std::unique_lock lock(m_mutex);
+            while (true) {
+                m_cv.wait(lock, [this] { return m_stopping || !m_queue.empty(); });
+                if (m_queue.empty()) {
+                    return;
+                }
+                auto job = m_queue.front();
+                m_queue.pop_front();
+                std::chrono::nanoseconds wait = std::chrono::steady_clock::now() - job->queued;
+                m_total_wait += wait;
+                m_max_wait = std::max(m_max_wait, wait);
+                ++m_running;
+                lock.unlock();
+                job->run();
+                lock.lock();
+                --m_running;
+                ++m_completed;
+                lock.unlock();
+                job->resume();
+                lock.lock();
+            }
+        }
+
+        run_queue& m_loop;
+        std::size_t m_max_queued;
+        mutable std::mutex m_mutex;
+        std::condition_variable m_cv;
+        std::deque<detail::offload_job*> m_queue;
+        std::vector<std::thread> m_threads;
+        bool m_stopping = false;
+        std::size_t m_running = 0;
+        std::uint64_t m_completed = 0;
+        std::uint64_t m_rejected = 0;
+        std::chrono::nanoseconds m_total_wait{0};
+        std::chrono::nanoseconds m_max_wait{0};
+};
+
+namespace detail {
+
+template <typename FN>
+class offload_awaiter : public offload_job {
+        using value_type = std::invoke_result_t<FN&>;
+
+    public:
+        offload_awaiter(blocking_pool& pool, FN fn) : m_pool(pool), m_fn(std::move(fn)) {}
+
+        bool await_ready() const noexcept { return false; }
+        template <typename PROMISE>
+        bool await_suspend(std::coroutine_handle<PROMISE> continuation) {
+            m_continuation = continuation;
+            m_loop = run_queue::current();
+            if (!m_loop) {
+                m_loop = &m_pool.loop();
+            }
+            if constexpr (std::is_base_of_v<async_promise_base, PROMISE>) {
+                m_priority = continuation.promise().priority();
+            }
+            if (!m_pool.submit(this)) {
+                m_exception = std::make_exception_ptr(offload_rejected{});
+                return false;
+            }
+            return true;
+        }
+        value_type await_resume() {
+            if (m_exception) {
+                std::rethrow_exception(m_exception);
+            }
+            if constexpr (!std::is_void_v<value_type>) {
+                return std::move(*m_value);
+            }
+        }
+
+    private:
+        // on a thread of the pool
+        void run() noexcept override {
+            try {
+                if constexpr (std::is_void_v<value_type>) {
+                    std::invoke(m_fn);
+                } else {
+                    m_value.emplace(std::invoke(m_fn));
+                }
+            } catch (...) {
+                m_exception = std::current_exception();
+            }
+        }
+        void resume() noexcept override {
+            // this must not be touched after post() as the loop might resume the continuation right away
+            auto continuation = m_continuation;
+            try {
+                m_loop->post([continuation] { continuation.resume(); }, m_priority);
+            } catch (...) {
+                // e.g. bad_alloc, the coroutine can only continue with the exception on the pool's thread
+                m_exception = std::current_exception();
+                continuation.resume();
+            }
+        }
+
+        blocking_pool& m_pool;
+        run_queue* m_loop = nullptr;
+        FN m_fn;
+        std::coroutine_handle<> m_continuation;
+        int m_priority = 0;
+        std::conditional_t<std::is_void_v<value_type>, bool, std::optional<value_type>> m_value;
+        std::exception_ptr m_exception;
+};
+
+}  // namespace detail
+
+// co_await offload(pool, fn) runs fn() on a thread of the pool and continues with its result or exception on
+// the run_queue the coroutine was running on
+template <typename FN>
+detail::offload_awaiter<std::decay_t<FN>> offload(blocking_pool& pool, FN&& fn) {
+    return {pool, std::forward<FN>(fn)};
+}
+
+}  // namespace cppasync
@@ -0,0 +1,136 @@
+#pragma once
+
+// a sampling profiler for the logical call stacks of coroutines. requires CPPASYNC_PROFILE to be defined
+// for all translation units, which makes each promise remember its function and the coroutine awaiting it.
+
+#ifdef CPPASYNC_PROFILE
+
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <signal.h>
+#include <sys/time.h>
+
+#include "async.hh"
+
+CPPASYNC_EXPORT namespace cppasync {
+
+// samples the coroutine running on the thread receiving SIGPROF, which the kernel sends every 'interval' of
+// cpu time consumed by the process, along with the coroutines it was called by or is awaited by. the stacks
+// are written in the folded format of flamegraph.pl:
+//
+//   sampling_profiler profiler;
+//   profiler.start();
+//   ...
+//   profiler.stop();
+//   std::ofstream out("async.folded");
+//   profiler.write_folded(out);
+//
+// only one profiler can be started at a time. samples beyond 'max_samples' are dropped.
+class sampling_profiler {
+    public:
+        explicit sampling_profiler(std::chrono::microseconds interval = std::chrono::milliseconds(1), std::size_t max_samples = 4096)
+            : m_interval(interval), m_samples(max_samples) {}
+        sampling_profiler(const sampling_profiler&) = delete;
+        sampling_profiler& operator=(const sampling_profiler&) = delete;
+        ~sampling_profiler() { stop(); }
+
+        void start() {
+            sampling_profiler* expected = nullptr;
+            if (!s_active.compare_exchange_strong(expected, this)) {
+                throw std::logic_error("another sampling_profiler has already been started");
+            }
+            struct sigaction action{};
+            action.sa_handler = &handler;
+            action.sa_flags = SA_RESTART;
+            sigemptyset(&action.sa_mask);
+            sigaction(SIGPROF, &action, &m_previous);
+            auto usec = std::max<long>(m_interval.count(), 1);
+            itimerval timer{{usec / 1000000, usec % 1000000}, {usec / 1000000, usec % 1000000}};
+            setitimer(ITIMER_PROF, &timer, nullptr);
+        }
+        void stop() noexcept {
+            if (s_active.load() != this) {
+                return;
+            }
+            itimerval timer{};
+            setitimer(ITIMER_PROF, &timer, nullptr);
+            s_active.store(nullptr);
+            // a handler which has seen this profiler might still be running on another thread
+            while (s_handlers.load() != 0) {
+                std::this_thread::yield();
+            }
+            sigaction(SIGPROF, &m_previous, nullptr);
+        }
+
+        // take a sample of the calling thread right away
+        void sample() noexcept {
+            auto index = m_taken.fetch_add(1, std::memory_order_relaxed);
+            if (index >= m_samples.size()) {
+                return;
+            }
+            auto& s = m_samples[index];
+            s.depth = detail::async_promise_base::stack(s.functions, max_depth);
+            s.ready.store(true, std::memory_order_release);
+        }
+        // the number of samples taken, including the dropped ones
+        std::size_t samples() const noexcept { return m_taken.load(std::memory_order_relaxed); }
+
+        // one line per stack, "outermost;...;innermost count". samples taken while no coroutine was running
+        // are omitted.
+        void write_folded(std::ostream& out) const {
+            std::map<std::string, std::size_t> stacks;
+            auto n = std::min(m_taken.load(std::memory_order_relaxed), m_samples.size());
+            for (std::size_t i = 0; i < n; ++i) {
+                auto& s = m_samples[i];
+                if (!s.ready.load(std::memory_order_acquire) || s.depth == 0) {
+                    continue;
+                }
+                std::string stack;
+                for (auto depth = s.depth; depth > 0; --depth) {
+                    if (!stack.empty()) {
+                        stack += ';';
+                    }
+                    stack += s.functions[depth - 1];
+                }
+                ++stacks[stack];
+            }
+            for (auto& [stack, count] : stacks) {
+                out << stack << ' ' << count << '\n';
+            }
+        }
+
+    private:
+        static constexpr std::size_t max_depth = 64;
+        struct sample_data {
+                std::atomic<bool> ready = false;
+                std::size_t depth = 0;
+                const char* functions[max_depth];
+        };
+
+        // counted before s_active is read, so that stop() can wait for the handlers using the profiler
+        static void handler(int) {
+            ++s_handlers;
+            if (auto profiler = s_active.load()) {
+                profiler->sample();
+            }
+            --s_handlers;
+        }
+
+        static inline std::atomic<sampling_profiler*> s_active = nullptr;
+        static inline std::atomic<unsigned> s_handlers = 0;
+        std::chrono::microseconds m_interval;
+        std::vector<sample_data> m_samples;
+        std::atomic<std::size_t> m_taken = 0;
+        struct sigaction m_previous{};
+};
+
+}  // namespace cppasync
+
+#endif
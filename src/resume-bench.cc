@@ -0,0 +1,58 @@
+// resume-bench: single threaded cost of co_await on async<T> and atomic_async<T>, once for coroutines which
+// finish without suspending and once for coroutines which are suspended and resumed again
+//
+// make resume-bench
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+#include "async.hh"
+#include "atomic_async.hh"
+
+using namespace cppasync;
+
+std::coroutine_handle<> pending;
+
+struct park {
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(std::coroutine_handle<> coro) noexcept { pending = coro; }
+        void await_resume() const noexcept {}
+};
+
+template <template <typename> class ASYNC>
+ASYNC<unsigned> leaf(unsigned value, bool suspend) {
+    if (suspend) {
+        co_await park{};
+    }
+    co_return value;
+}
+
+template <template <typename> class ASYNC>
+ASYNC<unsigned> loop(unsigned n, bool suspend) {
+    unsigned sum = 0;
+    for (unsigned i = 0; i < n; ++i) {
+        sum += co_await leaf<ASYNC>(i, suspend);
+    }
+    co_return sum;
+}
+
+template <template <typename> class ASYNC>
+void bench(const char* name, unsigned n, bool suspend) {
+    auto start = std::chrono::steady_clock::now();
+    auto outer = loop<ASYNC>(n, suspend);
+    while (pending) {
+        std::exchange(pending, nullptr).resume();
+    }
+    auto sum = outer.result();
+    std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+    std::printf("%-13s %-10s %6.2f ns per co_await (%u)\n", name, suspend ? "suspended" : "ready", elapsed.count() / n, sum);
+}
+
+int main(int argc, char* argv[]) {
+    unsigned n = argc > 1 ? std::atoi(argv[1]) : 10000000;
+    for (bool suspend : {false, true}) {
+        bench<async>("async", n, suspend);
+        bench<atomic_async>("atomic_async", n, suspend);
+    }
+}
@@ -0,0 +1,417 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <pthread.h>
+#endif
+
+#include "async.hh"
+
+CPPASYNC_EXPORT namespace cppasync {
+
+class shard;
+class shard_runtime;
+
+namespace detail {
+
+inline constexpr std::size_t cache_line_size = 64;
+
+// a message between shards: fn(arg) is run on the receiving shard
+struct shard_task {
+        void (*fn)(void*);
+        void* arg;
+};
+
+// bounded single producer, single consumer ring buffer. both sides only load and store their own index
+// and keep a copy of the other side's index, which is reloaded only when the queue looks full or empty.
+template <typename T>
+class spsc_queue {
+    public:
+        explicit spsc_queue(std::size_t capacity) {
+            std::size_t size = 2;
+            while (size < capacity) {
+                size *= 2;
+            }
+            m_buffer.reset(new T[size]);
+            m_mask = size - 1;
+        }
+        spsc_queue(const spsc_queue&) = delete;
+        spsc_queue& operator=(const spsc_queue&) = delete;
+
+        // producer side, returns false when the queue is full
+        bool push(const T& value) noexcept {
+            auto tail = m_producer.tail.load(std::memory_order_relaxed);
+            if (tail - m_producer.head >= m_mask + 1) {
+                m_producer.head = m_consumer.head.load(std::memory_order_acquire);
+                if (tail - m_producer.head >= m_mask + 1) {
+                    return false;
+                }
+            }
+            m_buffer[tail & m_mask] = value;
+            m_producer.tail.store(tail + 1, std::memory_order_release);
+            return true;
+        }
+        // consumer side, returns false when the queue is empty
+        bool pop(T& value) noexcept {
+            auto head = m_consumer.head.load(std::memory_order_relaxed);
+            if (head == m_consumer.tail) {
+                m_consumer.tail = m_producer.tail.load(std::memory_order_acquire);
+                if (head == m_consumer.tail) {
+                    return false;
+                }
+            }
+            value = m_buffer[head & m_mask];
+            m_consumer.head.store(head + 1, std::memory_order_release);
+            return true;
+        }
+        bool empty() const noexcept {
+            return m_consumer.head.load(std::memory_order_relaxed) == m_producer.tail.load(std::memory_order_acquire);
+        }
+
+    private:
+        struct alignas(cache_line_size) producer {
+                std::atomic<std::size_t> tail = 0;
+                std::size_t head = 0;  // cached m_consumer.head
+        };
+        struct alignas(cache_line_size) consumer {
+                std::atomic<std::size_t> head = 0;
+                std::size_t tail = 0;  // cached m_producer.tail
+        };
+        producer m_producer;
+        consumer m_consumer;
+        std::unique_ptr<T[]> m_buffer;
+        std::size_t m_mask;
+};
+
+inline thread_local shard* current_shard = nullptr;
+
+template <typename FN>
+class submit_awaiter;
+
+}  // namespace detail
+
+// one event loop per thread. a shard only runs the coroutines started on it and the tasks sent to it by the other
+// shards of its runtime, each of which has its own queue to it. everything else, like interlocks, belongs to the
+// shard which created it and must not be touched by the others.
+class alignas(detail::cache_line_size) shard {
+    public:
+        shard(shard_runtime* runtime, unsigned id, unsigned shards, std::size_t queue_capacity);
+        shard(const shard&) = delete;
+        shard& operator=(const shard&) = delete;
+
+        unsigned id() const noexcept { return m_id; }
+        // the shard running on the calling thread, nullptr outside of a shard_runtime
+        static shard* current() noexcept { return detail::current_shard; }
+
+        // run fn(arg) on the target shard, must be called on this shard's thread
+        void send(unsigned target, detail::shard_task task);
+
+    private:
+        friend class shard_runtime;
+        struct main_completion : detail::completion {
+                shard* self;
+                explicit main_completion(shard* self) noexcept : self(self) {}
+                std::coroutine_handle<> complete() noexcept override;
+        };
+        void loop();
+        bool poll();
+        bool flush() noexcept;
+        void notify() noexcept;
+        void park() noexcept;
+        void wake() noexcept;
+
+        shard_runtime* m_runtime;
+        unsigned m_id;
+        // m_inbox[from] holds the tasks sent by shard 'from'
+        std::vector<std::unique_ptr<detail::spsc_queue<detail::shard_task>>> m_inbox;
+        // m_overflow[to] holds the tasks which didn't fit into the target's inbox yet
+        std::vector<std::deque<detail::shard_task>> m_overflow;
+        std::size_t m_overflowed = 0;
+        // the shards sent to since the last notify()
+        std::vector<unsigned> m_notify;
+        std::vector<bool> m_notified;
+        alignas(detail::cache_line_size) std::atomic<bool> m_sleeping = false;
+        async<> m_main;
+        main_completion m_completion;
+        std::exception_ptr m_exception;
+};
+
+// runs one shard per thread, optionally pinned to a core:
+//
+//   shard_runtime runtime;
+//   runtime.run([](shard& self) -> async<> { ... co_await submit_to(other, [] { return work(); }); ... });
+//
+// run() starts the coroutine returned by fn(shard) on every shard and returns after all of them are finished.
+// each shard has one queue of 'queue_capacity' tasks per sender, i.e. shards² queues are allocated up front.
+// they are kept small, tasks which don't fit wait in the sender's overflow until the target has taken some.
+class shard_runtime {
+    public:
+        explicit shard_runtime(unsigned shards = std::thread::hardware_concurrency(), std::size_t queue_capacity = 64, bool pin = true) : m_pin(pin) {
+            shards = std::max(shards, 1u);
+            for (unsigned id = 0; id < shards; ++id) {
+                m_shards.emplace_back(std::make_unique<shard>(this, id, shards, queue_capacity));
+            }
+        }
+        shard_runtime(const shard_runtime&) = delete;
+        shard_runtime& operator=(const shard_runtime&) = delete;
+
+        unsigned size() const noexcept { return static_cast<unsigned>(m_shards.size()); }
+        shard& operator[](unsigned id) noexcept { return *m_shards[id]; }
+
+        // fn(shard&) must return an async<>, the first exception thrown by one of them is rethrown
+        template <typename FN>
+        void run(FN fn) {
+            m_finished.store(0, std::memory_order_relaxed);
+            std::vector<std::thread> threads;
+            for (auto& s : m_shards) {
+                threads.emplace_back([this, &s, &fn] {
+                    pin(s->id());
+                    detail::current_shard = s.get();
+                    try {
+                        s->m_main = fn(*s);
+                    } catch (...) {
+                        s->m_exception = std::current_exception();
+                    }
+                    if (!s->m_main.on_complete(&s->m_completion)) {
+                        finished();
+                    }
+                    s->loop();
+                    detail::current_shard = nullptr;
+                });
+            }
+            for (auto& thread : threads) {
+                thread.join();
+            }
+            std::exception_ptr eptr;
+            for (auto& s : m_shards) {
+                if (!s->m_exception && s->m_main.done()) {
+                    try {
+                        s->m_main.result();
+                    } catch (...) {
+                        s->m_exception = std::current_exception();
+                    }
+                }
+                if (!eptr) {
+                    eptr = s->m_exception;
+                }
+                s->m_main = async<>{};
+                s->m_exception = nullptr;
+            }
+            if (eptr) {
+                std::rethrow_exception(eptr);
+            }
+        }
+
+    private:
+        friend class shard;
+        void pin([[maybe_unused]] unsigned id) noexcept {
+#ifdef __linux__
+            if (m_pin) {
+                cpu_set_t cpus;
+                CPU_ZERO(&cpus);
+                CPU_SET(id % std::max(std::thread::hardware_concurrency(), 1u), &cpus);
+                pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+            }
+#endif
+        }
+        // a shard's main coroutine is finished, wake the others to check whether they're done too
+        void finished() noexcept {
+            if (m_finished.fetch_add(1, std::memory_order_acq_rel) + 1 == m_shards.size()) {
+                for (auto& s : m_shards) {
+                    s->wake();
+                }
+            }
+        }
+        bool all_finished() const noexcept { return m_finished.load(std::memory_order_acquire) == m_shards.size(); }
+
+        std::vector<std::unique_ptr<shard>> m_shards;
+        std::atomic<std::size_t> m_finished = 0;
+        bool m_pin;
+};
+
+inline shard::shard(shard_runtime* runtime, unsigned id, unsigned shards, std::size_t queue_capacity)
+    : m_runtime(runtime), m_id(id), m_overflow(shards), m_notified(shards), m_completion(this) {
+    for (unsigned from = 0; from < shards; ++from) {
+        m_inbox.emplace_back(std::make_unique<detail::spsc_queue<detail::shard_task>>(queue_capacity));
+    }
+}
+
+inline std::coroutine_handle<> shard::main_completion::complete() noexcept {
+    self->m_runtime->finished();
+    return std::noop_coroutine();
+}
+
+inline void shard::send(unsigned target, detail::shard_task task) {
+    if (m_overflow[target].empty() && m_runtime->m_shards[target]->m_inbox[m_id]->push(task)) {
+        if (!m_notified[target]) {
+            m_notified[target] = true;
+            m_notify.push_back(target);
+        }
+        return;
+    }
+    m_overflow[target].push_back(task);
+    ++m_overflowed;
+}
+
+// run the tasks received so far, returns false when there were none
+inline bool shard::poll() {
+    bool worked = flush();
+    for (auto& inbox : m_inbox) {
+        detail::shard_task task;
+        while (inbox->pop(task)) {
+            task.fn(task.arg);
+            worked = true;
+        }
+    }
+    return worked;
+}
+
+// move the overflowed tasks into the inboxes of their targets
+inline bool shard::flush() noexcept {
+    if (m_overflowed == 0) {
+        return false;
+    }
+    bool moved = false;
+    for (unsigned target = 0; target < m_overflow.size(); ++target) {
+        auto& overflow = m_overflow[target];
+        auto& to = *m_runtime->m_shards[target];
+        while (!overflow.empty() && to.m_inbox[m_id]->push(overflow.front())) {
+            overflow.pop_front();
+            --m_overflowed;
+            moved = true;
+            if (!m_notified[target]) {
+                m_notified[target] = true;
+                m_notify.push_back(target);
+            }
+        }
+    }
+    return moved;
+}
+
+// wake the shards sent to which went to sleep, once per batch of tasks instead of once per send()
+inline void shard::notify() noexcept {
+    if (m_notify.empty()) {
+        return;
+    }
+    // pairs with the fence in park(): either the target sees the task or we see it sleeping
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    for (auto target : m_notify) {
+        m_notified[target] = false;
+        auto& to = *m_runtime->m_shards[target];
+        if (to.m_sleeping.load(std::memory_order_relaxed)) {
+            to.wake();
+        }
+    }
+    m_notify.clear();
+}
+
+inline void shard::loop() {
+    while (true) {
+        bool worked = poll();
+        notify();
+        if (worked) {
+            continue;
+        }
+        if (m_runtime->all_finished() && m_overflowed == 0) {
+            return;
+        }
+        if (m_overflowed != 0) {
+            // the target is busy, keep trying
+            std::this_thread::yield();
+            continue;
+        }
+        park();
+    }
+}
+
+inline void shard::park() noexcept {
+    m_sleeping.store(true, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    bool idle = !m_runtime->all_finished();
+    for (auto& inbox : m_inbox) {
+        idle = idle && inbox->empty();
+    }
+    if (idle) {
+        m_sleeping.wait(true, std::memory_order_acquire);
+    }
+    m_sleeping.store(false, std::memory_order_relaxed);
+}
+
+inline void shard::wake() noexcept {
+    m_sleeping.store(false, std::memory_order_release);
+    m_sleeping.notify_one();
+}
+
+namespace detail {
+
+// suspends the submitting coroutine, runs fn() on the target shard and resumes the coroutine on its own
+// shard with the result. the awaiter lives in the submitting coroutine's frame while being passed around.
+template <typename FN>
+class submit_awaiter {
+        using async_type = std::invoke_result_t<FN&>;
+        using value_type = typename async_type::value_type;
+
+    public:
+        submit_awaiter(unsigned target, FN fn) : m_target(target), m_fn(std::move(fn)) {}
+
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(std::coroutine_handle<> continuation) {
+            m_source = shard::current();
+            if (!m_source) {
+                throw std::logic_error("submit_to() called outside of a shard");
+            }
+            m_continuation = continuation;
+            m_source->send(m_target, {&start, this});
+        }
+        std::conditional_t<std::is_void_v<value_type>, void, value_type> await_resume() {
+            if (m_exception) {
+                std::rethrow_exception(m_exception);
+            }
+            if constexpr (!std::is_void_v<value_type>) {
+                return std::move(*m_value);
+            }
+        }
+
+    private:
+        // on the target shard
+        static void start(void* self) { run(static_cast<submit_awaiter*>(self)).no_wait(); }
+        static async<> run(submit_awaiter* self) {
+            try {
+                if constexpr (std::is_void_v<value_type>) {
+                    co_await std::invoke(self->m_fn);
+                } else {
+                    self->m_value.emplace(co_await std::invoke(self->m_fn));
+                }
+            } catch (...) {
+                self->m_exception = std::current_exception();
+            }
+            // self must not be touched after this as the submitting coroutine might be resumed right away
+            shard::current()->send(self->m_source->id(), {&finish, self});
+        }
+        // back on the source shard
+        static void finish(void* self) { static_cast<submit_awaiter*>(self)->m_continuation.resume(); }
+
+        unsigned m_target;
+        FN m_fn;
+        shard* m_source = nullptr;
+        std::coroutine_handle<> m_continuation;
+        std::conditional_t<std::is_void_v<value_type>, bool, std::optional<value_type>> m_value;
+        std::exception_ptr m_exception;
+};
+
+}  // namespace detail
+
+// co_await submit_to(target, fn) runs the coroutine returned by fn() on the target shard and continues
+// with its result on the calling shard. fn is called on the target shard.
+template <typename FN>
+detail::submit_awaiter<std::decay_t<FN>> submit_to(unsigned target, FN&& fn) {
+    return {target, std::forward<FN>(fn)};
+}
+
+}  // namespace cppasync
@@ -0,0 +1,218 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <span>
+#include <stdexcept>
+#include <string_view>
+#include <vector>
+
+#include <sys/uio.h>
+
+#include "async.hh"
+
+CPPASYNC_EXPORT namespace cppasync {
+
+class end_of_stream : public std::runtime_error {
+    public:
+        end_of_stream() : std::runtime_error("end of stream") {}
+        explicit end_of_stream(const std::string& what) : runtime_error(what) {}
+        explicit end_of_stream(const char* what) : runtime_error(what) {}
+};
+
+// buffered reads from a STREAM providing
+//
+//   async<std::size_t> read_some(std::span<std::byte> buffer);  // returns 0 at the end of the stream
+//
+// the spans returned by read_exact() and read_until() point into the reader's buffer and remain valid until
+// the next read. reads which can be served from the buffer don't call the stream and don't allocate. the buffer
+// grows up to 'max_size' for longer messages, beyond that std::length_error is thrown. only one read may be
+// awaited at a time.
+template <typename STREAM>
+class async_stream_reader {
+    public:
+        explicit async_stream_reader(STREAM& stream, std::size_t capacity = 4096, std::size_t max_size = 1024 * 1024)
+            : m_stream(stream), m_buffer(std::max<std::size_t>(capacity, 1)), m_max_size(std::max(max_size, m_buffer.size())) {}
+        async_stream_reader(const async_stream_reader&) = delete;
+        async_stream_reader& operator=(const async_stream_reader&) = delete;
+
+        // the next n bytes, throws end_of_stream when the stream ends before
+        async<std::span<const std::byte>> read_exact(std::size_t n) {
+            release();
+            if (m_end - m_begin >= n) {
+                return make_ready_async(take(n));
+            }
+            return read_exact_slow(n);
+        }
+        // the bytes up to and including the delimiter, throws end_of_stream when the stream ends before
+        async<std::span<const std::byte>> read_until(std::byte delimiter) {
+            release();
+            if (auto n = find(delimiter)) {
+                return make_ready_async(take(n));
+            }
+            return read_until_slow(delimiter);
+        }
+        async<std::span<const std::byte>> read_until(char delimiter) { return read_until(static_cast<std::byte>(delimiter)); }
+
+        // the bytes read from the stream but not yet returned
+        std::span<const std::byte> buffered() const noexcept { return {m_buffer.data() + m_begin + m_taken, m_end - m_begin - m_taken}; }
+
+    private:
+        async<std::span<const std::byte>> read_exact_slow(std::size_t n) {
+            while (m_end - m_begin < n) {
+                co_await fill(n);
+            }
+            co_return take(n);
+        }
+        async<std::span<const std::byte>> read_until_slow(std::byte delimiter) {
+            std::size_t n;
+            while ((n = find(delimiter)) == 0) {
+                co_await fill(m_end - m_begin + 1);
+            }
+            co_return take(n);
+        }
+
+        // the span returned by the last read is released by the next one
+        void release() noexcept {
+            m_begin += m_taken;
+            m_taken = 0;
+            m_scanned = std::max(m_scanned, m_begin);
+            if (m_begin == m_end) {
+                m_begin = m_end = m_scanned = 0;
+            }
+        }
+        std::span<const std::byte> take(std::size_t n) noexcept {
+            m_taken = n;
+            return {m_buffer.data() + m_begin, n};
+        }
+        // the length up to and including the delimiter or 0. bytes already scanned aren't scanned again.
+        std::size_t find(std::byte delimiter) noexcept {
+            auto start = m_buffer.data() + m_scanned;
+            if (auto found = static_cast<const std::byte*>(std::memchr(start, std::to_integer<int>(delimiter), m_end - m_scanned))) {
+                return found + 1 - (m_buffer.data() + m_begin);
+            }
+            m_scanned = m_end;
+            return 0;
+        }
+        // read more from the stream, making room for at least 'size' unread bytes
+        async<> fill(std::size_t size) {
+            if (m_buffer.size() - m_begin < size || m_end == m_buffer.size()) {
+                if (size > m_buffer.size()) {
+                    if (size > m_max_size) {
+                        throw std::length_error("async_stream_reader: message exceeds the maximal buffer size");
+                    }
+                    std::vector<std::byte> buffer(std::min(std::max(size, m_buffer.size() * 2), m_max_size));
+                    std::memcpy(buffer.data(), m_buffer.data() + m_begin, m_end - m_begin);
+                    m_buffer.swap(buffer);
+                } else {
+                    std::memmove(m_buffer.data(), m_buffer.data() + m_begin, m_end - m_begin);
+                }
+                m_scanned -= m_begin;
+                m_end -= m_begin;
+                m_begin = 0;
+            }
+            auto n = co_await m_stream.read_some(std::span<std::byte>(m_buffer.data() + m_end, m_buffer.size() - m_end));
+            if (n == 0) {
+                throw end_of_stream();
+            }
+            m_end += n;
+        }
+
+        STREAM& m_stream;
+        std::vector<std::byte> m_buffer;
+        std::size_t m_max_size;
+        std::size_t m_begin = 0;    // first unread byte
+        std::size_t m_end = 0;      // end of the bytes read from the stream
+        std::size_t m_taken = 0;    // bytes returned by the last read, released by the next one
+        std::size_t m_scanned = 0;  // read_until() has already searched [m_begin, m_scanned)
+};
+
+// buffered writes to a STREAM providing
+//
+//   async<std::size_t> write_some(std::span<const iovec> buffers);  // like writev(), returns the bytes written
+//
+// writes of up to 'copy_limit' bytes are copied into the writer's buffer and return without calling the stream.
+// they're written along with the next larger write, which isn't copied and must remain valid until it's finished,
+// or by flush(), each with a single write_some() call for all buffers. only one write may be awaited at a time.
+template <typename STREAM>
+class async_stream_writer {
+    public:
+        explicit async_stream_writer(STREAM& stream, std::size_t capacity = 4096, std::size_t copy_limit = 512)
+            : m_stream(stream), m_buffer(std::max<std::size_t>(capacity, 1)), m_copy_limit(std::min(copy_limit, m_buffer.size())) {}
+        async_stream_writer(const async_stream_writer&) = delete;
+        async_stream_writer& operator=(const async_stream_writer&) = delete;
+
+        async<> write(std::span<const std::byte> data) {
+            if (data.size() <= m_copy_limit) {
+                if (m_buffer.size() - m_size >= data.size()) {
+                    copy(data);
+                    return make_ready_async();
+                }
+                return flush_and_copy(data);
+            }
+            if (m_size != 0) {
+                m_iov.push_back({m_buffer.data(), m_size});
+            }
+            m_iov.push_back({const_cast<std::byte*>(data.data()), data.size()});
+            return write_all();
+        }
+        async<> write(std::string_view data) { return write(std::as_bytes(std::span(data))); }
+
+        // write the buffered bytes
+        async<> flush() {
+            if (m_size == 0) {
+                return make_ready_async();
+            }
+            m_iov.push_back({m_buffer.data(), m_size});
+            return write_all();
+        }
+
+        // the number of bytes waiting for the next flush()
+        std::size_t buffered() const noexcept { return m_size; }
+
+    private:
+        void copy(std::span<const std::byte> data) noexcept {
+            std::memcpy(m_buffer.data() + m_size, data.data(), data.size());
+            m_size += data.size();
+        }
+        async<> flush_and_copy(std::span<const std::byte> data) {
+            co_await flush();
+            copy(data);
+        }
+        // the buffers are dropped on every exit, also when write_some() throws or the coroutine is destroyed, so that
+        // no later write passes the caller's data again
+        struct drop_buffers {
+                async_stream_writer* writer;
+                ~drop_buffers() {
+                    writer->m_iov.clear();
+                    writer->m_size = 0;
+                }
+        };
+        async<> write_all() {
+            drop_buffers drop{this};
+            std::size_t first = 0;
+            while (first < m_iov.size()) {
+                auto n = co_await m_stream.write_some(std::span<const iovec>(m_iov.data() + first, m_iov.size() - first));
+                if (n == 0) {
+                    throw end_of_stream();
+                }
+                // skip the buffers which have been written completely and advance into the partially written one
+                while (first < m_iov.size() && n >= m_iov[first].iov_len) {
+                    n -= m_iov[first++].iov_len;
+                }
+                if (n != 0) {
+                    m_iov[first].iov_base = static_cast<std::byte*>(m_iov[first].iov_base) + n;
+                    m_iov[first].iov_len -= n;
+                }
+            }
+        }
+
+        STREAM& m_stream;
+        std::vector<std::byte> m_buffer;
+        std::size_t m_size = 0;
+        std::size_t m_copy_limit;
+        std::vector<iovec> m_iov;
+};
+
+}  // namespace cppasync